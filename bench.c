@@ -0,0 +1,286 @@
+/*
+ A benchmark for the modplayer, for catching performance regressions and comparing kernels.
+ For each mod it reports:
+	- how long modplayer_create_from_buffer() takes to load it
+	- where the time goes while playing: output_frames() per frame, the sequencer per line and per tick
+	- the realtime factor (seconds of audio decoded per second of cpu) for mono and stereo, several
+	  sample rates, 16 bit and float output, and each interpolation mode
+
+ Compile with:
+ gcc bench.c -o bench -std=c99 -O2
+
+ and try the simd options as well, e.g. -mavx2, -DMOD_PLAYER_NO_SIMD or -DMOD_PLAYER_FIXED_POINT
+
+ Run:
+ bench [-s seconds] <modfile.mod> [more.mod ...]
+
+ each figure is the best of a few runs of `seconds` of audio (default 30)
+
+*/
+
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 199309L // for clock_gettime
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MOD_PLAYER_IMPLEMENTATION
+#include "modplayer.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define NUM_RUNS 3
+
+static double now_seconds(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+static unsigned char* read_file(const char* filename, unsigned int* len)
+{
+	FILE* fp = fopen(filename, "rb");
+	if(fp == NULL)
+		return NULL;
+
+	fseek(fp, 0, SEEK_END);
+	*len = (unsigned int)ftell(fp);
+	rewind(fp);
+
+	unsigned char* buf = (unsigned char*)malloc(*len);
+	if(fread(buf, *len, 1, fp) != 1)
+	{
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	return buf;
+}
+
+// average time to load the mod, in microseconds
+static double bench_load(unsigned char* buf, unsigned int len)
+{
+	int count = 0;
+	double start = now_seconds();
+	double elapsed = 0.0;
+	while(elapsed < 0.25)
+	{
+		mp_mod_player* modplayer = modplayer_create_from_buffer(buf, len);
+		modplayer_free(modplayer);
+		++count;
+		elapsed = now_seconds() - start;
+	}
+	return elapsed * 1e6 / count;
+}
+
+typedef struct stage_times
+{
+	double mix_ns_per_frame;
+	double line_ns;
+	double tick_ns;
+} stage_times;
+
+// play the song the way play_frames() does, timing output_frames() and each run of the sequencer
+// separately. the timer's own cost is taken off the sequencer figures, as they're only a few hundred ns
+static stage_times bench_stages(mp_mod_player* modplayer, unsigned int total_frames)
+{
+	unsigned int out_channels = modplayer->output_channel_count;
+	float* buffer = (float*)malloc(sizeof(float) * 1024 * out_channels);
+
+	double timer_cost = now_seconds();
+	for(int i=0; i<999; ++i)
+		now_seconds();
+	timer_cost = (now_seconds() - timer_cost) / 1000.0;
+
+	double mix_time = 0.0;
+	double line_time = 0.0;
+	double tick_time = 0.0;
+	int num_lines = 0;
+	int num_ticks = 0;
+
+	modplayer_reset_song_to_beginning(modplayer);
+	unsigned int frames_remaining = total_frames;
+	while(frames_remaining > 0)
+	{
+		unsigned int num_frames = frames_remaining < 1024 ? frames_remaining : 1024;
+		if((int)num_frames > modplayer->frames_until_next_tick)
+			num_frames = modplayer->frames_until_next_tick;
+
+		double start = now_seconds();
+		output_frames(modplayer, num_frames, buffer);
+		mix_time += now_seconds() - start;
+
+		modplayer->frames_until_next_tick -= num_frames;
+		modplayer->position_frames += num_frames;
+		frames_remaining -= num_frames;
+
+		if(modplayer->frames_until_next_tick == 0)
+		{
+			start = now_seconds();
+			int events = next_tick(modplayer);
+			double elapsed = now_seconds() - start - timer_cost;
+			if(events & SeqEvent_NewLine)
+			{
+				line_time += elapsed;
+				num_lines++;
+			}
+			else
+			{
+				tick_time += elapsed;
+				num_ticks++;
+			}
+		}
+	}
+
+	free(buffer);
+
+	stage_times times;
+	times.mix_ns_per_frame = mix_time * 1e9 / total_frames;
+	times.line_ns = num_lines > 0 ? line_time * 1e9 / num_lines : 0.0;
+	times.tick_ns = num_ticks > 0 ? tick_time * 1e9 / num_ticks : 0.0;
+	return times;
+}
+
+// decode the start of the song in 1024 frame calls. returns the realtime factor
+static double bench_decode(mp_mod_player* modplayer, unsigned int total_frames, bool float_output, void* buffer)
+{
+	unsigned int out_channels = modplayer->output_channel_count;
+
+	modplayer_reset_song_to_beginning(modplayer);
+	double start = now_seconds();
+	for(unsigned int frame=0; frame<total_frames; frame += 1024)
+	{
+		unsigned int num_frames = total_frames - frame < 1024 ? total_frames - frame : 1024;
+		if(float_output)
+			modplayer_decode_frames_f(modplayer, num_frames, (float*)buffer + frame * out_channels);
+		else
+			modplayer_decode_frames(modplayer, num_frames, (short*)buffer + frame * out_channels);
+	}
+	double elapsed = now_seconds() - start;
+
+	return (double)total_frames / modplayer->output_sample_rate / elapsed;
+}
+
+static double best_decode(mp_mod_player* modplayer, unsigned int total_frames, bool float_output, void* buffer)
+{
+	double best = 0.0;
+	for(int run=0; run<NUM_RUNS; ++run)
+	{
+		double factor = bench_decode(modplayer, total_frames, float_output, buffer);
+		best = factor > best ? factor : best;
+	}
+	return best;
+}
+
+static const char* interpolation_names[] = { "nearest", "linear", "cubic", "sinc" };
+
+static void bench_mod(const char* filename, float seconds)
+{
+	unsigned int len = 0;
+	unsigned char* buf = read_file(filename, &len);
+	mp_mod_player* modplayer = buf != NULL ? modplayer_create_from_buffer(buf, len) : NULL;
+	if(modplayer == NULL)
+	{
+		fprintf(stderr, "Error loading %s, skipping it\n", filename);
+		free(buf);
+		return;
+	}
+
+	printf("%s (%s)\n", filename, modplayer->mod->name);
+	printf("  load                %8.1f us\n", bench_load(buf, len));
+
+	// the stage figures are for the defaults: 48kHz stereo, linear interpolation
+	unsigned int total_frames = (unsigned int)(seconds * 48000);
+	stage_times best = bench_stages(modplayer, total_frames);
+	for(int run=1; run<NUM_RUNS; ++run)
+	{
+		stage_times times = bench_stages(modplayer, total_frames);
+		best.mix_ns_per_frame = times.mix_ns_per_frame < best.mix_ns_per_frame ? times.mix_ns_per_frame : best.mix_ns_per_frame;
+		best.line_ns = times.line_ns < best.line_ns ? times.line_ns : best.line_ns;
+		best.tick_ns = times.tick_ns < best.tick_ns ? times.tick_ns : best.tick_ns;
+	}
+	printf("  output_frames()     %8.2f ns/frame\n", best.mix_ns_per_frame);
+	printf("  sequencer           %8.0f ns/line  %8.0f ns/tick\n", best.line_ns, best.tick_ns);
+
+	// big enough for the longest render: stereo floats at the highest rate
+	static const unsigned int sample_rates[] = { 22050, 44100, 48000, 96000 };
+	void* buffer = malloc((size_t)(seconds * 96000) * 2 * sizeof(float));
+
+	printf("  realtime factor      rate     mono s16   mono f32  stereo s16 stereo f32\n");
+	for(int r=0; r<4; ++r)
+	{
+		modplayer_set_sample_rate(modplayer, sample_rates[r]);
+		total_frames = (unsigned int)(seconds * sample_rates[r]);
+		printf("                    %6u", sample_rates[r]);
+		for(int stereo=0; stereo<2; ++stereo)
+		{
+			modplayer_set_stereo(modplayer, stereo != 0);
+			printf("  %9.0f", best_decode(modplayer, total_frames, false, buffer));
+			printf("  %9.0f", best_decode(modplayer, total_frames, true, buffer));
+		}
+		printf("\n");
+	}
+
+	modplayer_set_sample_rate(modplayer, 48000);
+	total_frames = (unsigned int)(seconds * 48000);
+	printf("  interpolation (48kHz stereo f32)");
+	for(int mode=MP_INTERPOLATION_NEAREST; mode<=MP_INTERPOLATION_SINC; ++mode)
+	{
+		modplayer_set_interpolation(modplayer, (mp_interpolation)mode);
+		printf("  %s %.0f", interpolation_names[mode], best_decode(modplayer, total_frames, true, buffer));
+	}
+	printf("\n\n");
+
+	free(buffer);
+	modplayer_free(modplayer);
+	free(buf);
+}
+
+int main(int argc, char* argv[])
+{
+	float seconds = 30.0f;
+	int first_mod = 1;
+	if(argc > 2 && strcmp(argv[1], "-s") == 0)
+	{
+		seconds = (float)atof(argv[2]);
+		first_mod = 3;
+	}
+
+	if(first_mod >= argc || seconds <= 0.0f)
+	{
+		printf("Usage: bench [-s seconds] <modfile.mod> [more.mod ...]\n");
+		exit(0);
+	}
+
+#if defined(MOD_PLAYER_FIXED_POINT)
+	printf("fixed point, ");
+#endif
+#if defined(MP_SIMD_AVX2)
+	printf("avx2 kernels\n\n");
+#elif defined(MP_SIMD_SSE2)
+	printf("sse2 kernels\n\n");
+#elif defined(MP_SIMD_NEON)
+	printf("neon kernels\n\n");
+#else
+	printf("scalar kernels\n\n");
+#endif
+
+	for(int i=first_mod; i<argc; ++i)
+		bench_mod(argv[i], seconds);
+
+	return 0;
+}
@@ -8,6 +8,36 @@
 		#define MOD_PLAYER_IMPLEMENTATION
 	before you include this file in *one* C or C++ file to create the implementation.
 
+	The resampler uses SSE2, AVX2 or NEON when the compiler targets them (e.g. -msse2, -mavx2, or any arm64 build).
+	To force the plain C version define MOD_PLAYER_NO_SIMD before including the implementation.
+	Compiled as C++, the implementation builds a copy of the voice mixer for each output channel count,
+	interpolation mode and loop mode, and picks one per channel per block. The output is exactly the same.
+
+	Sample data is kept as the signed 8 bit values from the mod file, and converted to float while mixing.
+	Define MOD_PLAYER_FLOAT_SAMPLES to convert everything to float at load time instead (4x the memory).
+
+	Sample positions are 32.32 fixed point, so long samples don't lose precision, and the output is exactly
+	the same however the decoding is split up. Define MOD_PLAYER_FIXED_POINT to interpolate with integer
+	maths as well: playback is then exactly the same on every platform. (this can't be combined with
+	MOD_PLAYER_FLOAT_SAMPLES)
+
+	To use your own allocator, define MP_MALLOC(size) and MP_FREE(ptr) before including the implementation.
+	Each mod and each player is a single allocation, and so is a seek index.
+
+	Define MOD_PLAYER_THREADS to let modplayer_render_song() use several threads (pthreads, or win32 threads
+	on windows), and for modplayer_async_create(), which decodes on a thread of its own for audio callbacks to
+	read from. you may need to link with -pthread.
+
+	Mods with more than 4 channels are recognised by their signature (6CHN, 8CHN, FLT8, CD81, OKTA, 16CH and
+	the like) up to MP_MAX_CHANNELS. Each group of 4 channels is panned left, right, right, left, as on the Amiga.
+
+	Define MOD_PLAYER_STATS (everywhere the header is included) to have each player count what it does:
+	lines, ticks, frames mixed per channel, voices, loop wraps and clipping, see modplayer_get_stats(). It can
+	also call a hook around each line, tick and mixing pass, for timing them. Without it none of this is compiled.
+
+	modplayer_create_from_file_mapped() uses mmap (or MapViewOfFile on windows). Define MOD_PLAYER_NO_MMAP
+	on platforms that have neither, and it will read the file into memory instead.
+
 	Usage example:
 
 		mp_mod_player* modplayer = modplayer_create_from_file("somemod.mod");
@@ -20,6 +50,7 @@
 
 		modplayer->set_sample_rate(modplayer, 48000); // this is the default
 		modplayer->set_stereo(true); // this is also the default
+		modplayer_set_interpolation(modplayer, MP_INTERPOLATION_CUBIC); // smoother than the default, for a little more cpu
 
 		// create a buffer for 6 seconds of stereo audio at 48kHz
 		short* buffer = (short*)malloc(48000 * 2 * 6 * sizeof(short);
@@ -33,6 +64,29 @@
 
 		modplayer_free(modplayer);
 
+		// to play the same mod on several players at once, load it once and share it
+		mp_mod* mod = modplayer_mod_create_from_file("somemod.mod");
+		mp_mod_player* player1 = modplayer_create_from_mod(mod);
+		mp_mod_player* player2 = modplayer_create_from_mod(mod);
+		...
+		modplayer_free(player1);
+		modplayer_free(player2);
+		modplayer_mod_free(mod);
+
+		// to jump around in the song (e.g. for a scrub bar), build the seek index once and seek as you like
+		modplayer_build_seek_index(modplayer);
+		modplayer_seek_seconds(modplayer, 180.0f);
+
+		// to start playing while the mod is still downloading, push it into a loader as it arrives
+		mp_mod_loader* loader = modplayer_loader_create();
+		while(downloading)
+		{
+			modplayer_loader_push(loader, received_bytes, num_received_bytes);
+			if(modplayer == NULL && modplayer_loader_is_ready(loader, 64))
+				modplayer = modplayer_create_from_mod(modplayer_loader_get_mod(loader));
+			... decode as usual ...
+		}
+
 
 	Revision History:
 	v1.0	initial release
@@ -48,14 +102,98 @@ extern "C" {
 #endif
 
 typedef struct mp_mod_player mp_mod_player;
+typedef struct mp_mod mp_mod;
+
+// the most channels a mod can have (channel masks are 32 bits)
+#define MP_MAX_CHANNELS 32
 
 // load a mod file and initialise a mp_mod_player struct. The return value should be free'd with modplayer_free()
 mp_mod_player* modplayer_create_from_file(char* filename);
 // load a mod from memory and initialise a mp_mod_player struct. The return value should be free'd with modplayer_free()
 mp_mod_player* modplayer_create_from_buffer(unsigned char* buf, unsigned int buflen);
+// memory map a mod file and play it in place rather than reading it into memory (see modplayer_mod_create_from_file_mapped)
+mp_mod_player* modplayer_create_from_file_mapped(char* filename);
+// as modplayer_create_from_buffer() but plays the samples in place (see modplayer_mod_create_from_buffer_borrowed)
+mp_mod_player* modplayer_create_from_buffer_borrowed(unsigned char* buf, unsigned int buflen);
 // free a previously created mp_mod_player struct
 void modplayer_free(mp_mod_player* modplayer);
 
+// if you want to play the same mod more than once at the same time, load it once as a mp_mod
+// and create as many players for it as you need with modplayer_create_from_mod().
+// a loaded mp_mod is never modified, so players on different threads can share it.
+// each player only holds its own play position and channel state (a few hundred bytes).
+
+// load a mod file without creating a player. The return value should be free'd with modplayer_mod_free()
+mp_mod* modplayer_mod_create_from_file(char* filename);
+// load a mod from memory without creating a player. The return value should be free'd with modplayer_mod_free()
+mp_mod* modplayer_mod_create_from_buffer(unsigned char* buf, unsigned int buflen);
+// as above, but the sample data is played straight out of buf instead of being copied.
+// buf must stay valid, and unchanged, until modplayer_mod_free() has been called on the result.
+// (with MOD_PLAYER_FLOAT_SAMPLES the samples have to be converted, so they are copied anyway)
+mp_mod* modplayer_mod_create_from_buffer_borrowed(unsigned char* buf, unsigned int buflen);
+// memory map a mod file (read only) and play the samples straight out of the mapping.
+// the file is unmapped by modplayer_mod_free(). without mmap support (MOD_PLAYER_NO_MMAP) this is
+// the same as modplayer_mod_create_from_file()
+mp_mod* modplayer_mod_create_from_file_mapped(char* filename);
+// free a previously loaded mp_mod. every player created from it must have been free'd first
+void modplayer_mod_free(mp_mod* mod);
+// create a player for a loaded mod. the player references the mod, so the mod must outlive it.
+// The return value should be free'd with modplayer_free(), which leaves the mod alone.
+mp_mod_player* modplayer_create_from_mod(mp_mod* mod);
+
+// what modplayer_probe_buffer() reads from a mod without loading it
+typedef struct mp_sample_info
+{
+	char name[23];
+	int length;			// in bytes (one byte per sample), 0 for an unused sample
+	int volume;			// 0-64
+	int fine_tune;		// -8 to 7, in 1/8ths of a semitone
+	int loop_start;		// in bytes
+	int loop_length;	// in bytes, 0 if the sample doesn't loop
+} mp_sample_info;
+
+typedef struct mp_mod_info
+{
+	char name[21];
+	int num_channels;
+	int song_length;	// the number of orders (entries in the pattern table)
+	int num_patterns;
+	mp_sample_info samples[31]; // samples[i] is sample number i+1, as the patterns count them
+	unsigned int file_size;		// how long the file should be, header, patterns and sample data
+	double duration;	// in seconds, if it was measured: until the song ends or loops, see modplayer_measure_song()
+	double loop_start;	// in seconds, where playback carries on from after that
+} mp_mod_info;
+
+// read the name, channel count, orders and sample definitions of a mod, for indexing a library of them.
+// this only needs the first 1084 bytes of the file, and allocates nothing. if measure_duration is true the
+// song is timed as well, by running the sequencer's timing effects straight over the patterns, so it needs
+// them too (the first file_size bytes, less the sample data); otherwise the duration and loop start are 0.
+// returns false if it isn't a mod we can play (or the patterns are needed and buf is too short for them)
+bool modplayer_probe_buffer(const unsigned char* buf, unsigned int buflen, bool measure_duration, mp_mod_info* info);
+
+// to start playing a mod while it's still downloading, push the file into a loader as it arrives.
+// the mod is created as soon as the header and patterns are in (the sample data comes after them),
+// and its samples are filled in by later pushes. samples play as silence until their data arrives,
+// so playback can start once modplayer_loader_is_ready() says the first lines' samples are there.
+// pushing writes into the mod's sample data, so don't push while a player of the mod is decoding on
+// another thread: push and decode from the same thread (or take turns with a lock)
+typedef struct mp_mod_loader mp_mod_loader;
+
+// create a loader. The return value should be free'd with modplayer_loader_free()
+mp_mod_loader* modplayer_loader_create(void);
+// add the next len bytes of the file. returns false if it turns out not to be a mod we can play
+bool modplayer_loader_push(mp_mod_loader* loader, const unsigned char* data, unsigned int len);
+// the mod, once the header and patterns have been pushed, else NULL. it's the caller's to free with
+// modplayer_mod_free() (after the last push), the loader doesn't free it
+mp_mod* modplayer_loader_get_mod(mp_mod_loader* loader);
+// true once the mod has been created and every sample played in the first num_lines lines of the song
+// (in order, not following any jumps) is complete. 64 lines is the whole first pattern
+bool modplayer_loader_is_ready(mp_mod_loader* loader, int num_lines);
+// true once all of the sample data has been pushed
+bool modplayer_loader_is_complete(mp_mod_loader* loader);
+// free a loader. the mod stays, with any samples that hadn't arrived left silent
+void modplayer_loader_free(mp_mod_loader* loader);
+
 // set the output sample rate. default is 48000
 void modplayer_set_sample_rate(mp_mod_player* modplayer, unsigned int sample_rate);
 // set the number of channels to output. default is 2 channels (i.e. stereo)
@@ -66,14 +204,225 @@ void modplayer_set_stereo(mp_mod_player* modplayer, bool is_stereo);
 // the default is 1.0 (hard panning), 0.0 would result in a mono output (both channels the same)
 void modplayer_set_stereo_width(mp_mod_player* modplayer, float stereo_width);
 
+// how the samples are resampled to the output rate, see modplayer_set_interpolation()
+typedef enum mp_interpolation
+{
+	MP_INTERPOLATION_NEAREST,	// no interpolation, the sample at or before each position. gritty, like the hardware
+	MP_INTERPOLATION_LINEAR,	// straight lines between samples
+	MP_INTERPOLATION_CUBIC,		// catmull-rom spline through the 4 samples around each position
+	MP_INTERPOLATION_SINC		// windowed sinc (lanczos, 8 samples). smoothest, but notes pitched well above the
+								// output rate aren't band limited, so they can still alias
+} mp_interpolation;
+
+// choose the interpolation. the default is MP_INTERPOLATION_LINEAR. it can be changed at any time.
+// rough cost in cpu cycles per output frame for each playing channel (stereo, x86-64, gcc -O2; the last
+// column is MOD_PLAYER_FIXED_POINT with SSE2):
+//						SSE2	AVX2	NO_SIMD		FIXED_POINT
+//		NEAREST			3		3		3			2
+//		LINEAR			5		2		4			3
+//		CUBIC			12		11		11			10
+//		SINC			58		57		55			53
+// only LINEAR has vector kernels, the others are the same scalar code whatever the build. a 4 channel mod
+// at 48kHz, with 3 channels playing at a time, mixes about 150000 channel frames a second, so at 20
+// cycles a frame it needs about 3MHz of one core
+void modplayer_set_interpolation(mp_mod_player* modplayer, mp_interpolation interpolation);
+
 // reset the song to the start
 void modplayer_reset_song_to_beginning(mp_mod_player* modplayer);
+// seek to a time (in seconds from the start of the song). playback carries on exactly as if the song had
+// been played up to that point, but nothing before it is mixed. if a seek index has been built, this starts
+// from the nearest checkpoint before the given time, otherwise it has to step through from the beginning.
+void modplayer_seek_seconds(mp_mod_player* modplayer, float seconds);
+// seek to the start of an entry (order) in the pattern table. builds the seek index if there isn't one.
+// returns false if the order is out of range
+bool modplayer_seek_order(mp_mod_player* modplayer, int order);
+// step through the song once, without mixing, and keep a checkpoint of the player state at the start of
+// each order. this makes seeking cheap. the index is free'd with the player.
+// returns false if the index couldn't be allocated
+bool modplayer_build_seek_index(mp_mod_player* modplayer);
+// work out how long the song plays for without decoding any of it. only the sequencer runs (lines, speed
+// changes and jumps, no effects or mixing), so this takes microseconds rather than seconds.
+// song_frames is set to the number of frames (at the current sample rate) until the song gets back to a line it
+// has already played, i.e. where it ends or loops. if loop_frame isn't NULL it is set to the frame playback carries
+// on from after that, 0 if the song starts again from the beginning. the player's own position is left alone.
+// returns false if there wasn't the memory to run the sequencer, leaving song_frames and loop_frame alone
+bool modplayer_measure_song(mp_mod_player* modplayer, unsigned long long* song_frames, unsigned long long* loop_frame);
 // decode a given number of frames and write them to the given buffer.
 // the buffer should be large enough to contain frame_count*2 samples (if stereo), or frame_count samples (if mono).
-// the frames are output as interleaved (left,right) signed 16-bit integers.
+// the frames are output as interleaved (left,right) signed 16-bit integers. anything too loud is clipped.
 void modplayer_decode_frames(mp_mod_player* modplayer, unsigned int frame_count, short* buffer);
 // as above, but output the samples as 32-bit float values instead of 16bit.
 void modplayer_decode_frames_f(mp_mod_player* modplayer, unsigned int frame_count, float* buffer);
+// decode frame_count frames from each of num_players players in one call, for mixing lots of streams at once.
+// buffers[i] gets player i's frames, exactly as modplayer_decode_frames() would give them. the players are
+// decoded one after the other: each one's channels are already mixed a span of frames at a time, which keeps
+// the vector kernels busier than running the players side by side would
+void modplayer_decode_frames_batch(mp_mod_player** players, unsigned int num_players, unsigned int frame_count, short** buffers);
+// as above, but output 32-bit float values, like modplayer_decode_frames_f()
+void modplayer_decode_frames_batch_f(mp_mod_player** players, unsigned int num_players, unsigned int frame_count, float** buffers);
+// decode frame_count frames with each channel of the mod written to a buffer of its own, e.g. for exporting stems.
+// stems[i] gets channel i as interleaved 32-bit floats (frame_count*2 values if stereo), panned and scaled just as
+// it is in the mix, so the stems add up to the mixed output. stems needs modplayer_get_num_channels() entries,
+// and a NULL entry skips that channel's stem. the mix is written to buffer too, like modplayer_decode_frames_f(),
+// unless buffer is NULL. the song is only played once, however many stems there are
+void modplayer_decode_stems_f(mp_mod_player* modplayer, unsigned int frame_count, float** stems, float* buffer);
+// the number of channels in the mod being played
+int modplayer_get_num_channels(mp_mod_player* modplayer);
+
+// render the first frame_count frames of the song in one go, for exporting it to a file.
+// the song is split into runs of orders starting at the seek index checkpoints (the index is built if need be),
+// and with MOD_PLAYER_THREADS defined each run is rendered on its own thread, up to num_threads at once.
+// the output is exactly the same as resetting the song and calling modplayer_decode_frames() once for all
+// the frames. afterwards the player carries on from the end of the render.
+// returns false if there wasn't enough memory
+bool modplayer_render_song(mp_mod_player* modplayer, unsigned int frame_count, short* buffer, int num_threads);
+// as above, but output 32-bit float values. the same as a single call to modplayer_decode_frames_f()
+bool modplayer_render_song_f(mp_mod_player* modplayer, unsigned int frame_count, float* buffer, int num_threads);
+
+// mute or unmute a channel (0 based). a muted channel carries on playing, it just isn't heard
+void modplayer_set_channel_muted(mp_mod_player* modplayer, int channel, bool muted);
+
+// none of the functions above are thread safe: while one thread is decoding, another mustn't touch the player.
+// instead, control threads can post commands, which the decoding thread runs at the next tick boundary
+// (every 20ms or so at the default tempo). posting never blocks, and running them costs the decoder nothing
+// when there are none. the decode calls (and an async player's thread) run them, seeking and rendering don't
+typedef enum mp_command_type
+{
+	MP_COMMAND_SET_STEREO_WIDTH,	// value is the width, see modplayer_set_stereo_width()
+	MP_COMMAND_SET_INTERPOLATION,	// arg is an mp_interpolation
+	MP_COMMAND_MUTE_CHANNEL,		// arg is the channel, value is 1 to mute it or 0 to unmute it
+	MP_COMMAND_JUMP_TO_ORDER,		// arg is the order. this is modplayer_seek_order() if the seek index has already
+									// been built, otherwise a straight jump (building the index would stall the decoder).
+									// after a straight jump event positions count from the jump, and the next
+									// modplayer_seek_seconds() starts from the beginning of the song
+	MP_COMMAND_RESET_SONG			// back to the start of the song
+} mp_command_type;
+
+// post a command from any thread, see above. commands from one thread run in the order they were posted.
+// returns false if the queue is full (it holds MP_COMMAND_QUEUE_SIZE commands)
+bool modplayer_post_command(mp_mod_player* modplayer, mp_command_type type, int arg, float value);
+#define MP_COMMAND_QUEUE_SIZE 32
+
+// songs repeat themselves: the same orders come round again, and looping songs play the same lines for
+// as long as they're left on. with a render cache, the decode calls keep each line they mix, along with
+// everything the mix depended on (the sequencer, every channel and the output settings). when a line
+// starts out exactly the same as one in the cache, its frames are copied rather than mixed again.
+// the cache holds at most max_bytes (a line is about 45KB at 48kHz stereo, speed 6 and 125 bpm), and
+// when it's full the oldest lines make way for new ones, so it needs to hold the whole of the part that
+// repeats to help with it. a max_bytes of 0 turns the cache off again. returns false if out of memory.
+// don't use one for a mod that's still being loaded by a mp_mod_loader
+bool modplayer_set_render_cache(mp_mod_player* modplayer, unsigned int max_bytes);
+
+typedef struct mp_render_cache_stats
+{
+	unsigned long long hits;			// lines copied out of the cache
+	unsigned long long misses;			// lines looked up and not found, which were mixed (and kept if there was room)
+	unsigned long long evictions;		// lines dropped to make room for newer ones
+	unsigned long long frames_copied;	// frames that came out of the cache instead of being mixed
+	unsigned int num_lines;				// lines in the cache now
+	unsigned int bytes_used;			// how much of max_bytes they take up
+} mp_render_cache_stats;
+
+// how well the render cache is doing. all zeros if there is no cache
+void modplayer_get_render_cache_stats(mp_mod_player* modplayer, mp_render_cache_stats* stats);
+
+// for syncing to the music: an event callback is told where in each decode call every tick starts, to the frame,
+// so large buffers can be decoded and still be matched up exactly. the flags say what else started there
+typedef enum mp_event_flags
+{
+	MP_EVENT_TICK			= 0x1,	// set for every event
+	MP_EVENT_LINE			= 0x2,	// the first tick of a line
+	MP_EVENT_ORDER			= 0x4,	// the first line of a different order
+	MP_EVENT_PATTERN_LOOP	= 0x8,	// a pattern loop (E6x) jumped back
+	MP_EVENT_SONG_LOOP		= 0x10	// the song ran off the end of the pattern table and started again from order 0
+} mp_event_flags;
+
+typedef struct mp_event
+{
+	int flags;			// mp_event_flags
+	unsigned int frame;	// where the tick starts, in frames from the start of the buffer passed to the decode call.
+						// a tick that starts just after the last frame decoded is reported with frame = frame_count
+	unsigned long long position_frames; // where the tick starts, in frames since the start of the song. after a jump
+						// to an order the song doesn't reach from the start, in frames since the jump
+	int order;			// the order (position in the pattern table), line and tick that start here
+	int line;
+	int tick;
+} mp_event;
+
+typedef void (*mp_event_callback)(void* user_data, const mp_event* event);
+
+// set (or with callback=NULL, clear) the event callback. it's called by the decode calls (modplayer_decode_frames(),
+// _f(), the batch and stems versions, and an async player's thread) as they go, in order, before they return.
+// ticks that seeking, rendering or measuring the song step over aren't reported. commands posted with
+// modplayer_post_command() are run at a tick boundary before its event is sent, so the event is for wherever
+// they left the player. the first tick after a reset or a jump to an order is sent with MP_EVENT_LINE and
+// MP_EVENT_ORDER set, at the boundary where the command ran, or at frame 0 of the next decode call if the player
+// was reset or seeked directly (as it is when it's created)
+void modplayer_set_event_callback(mp_mod_player* modplayer, mp_event_callback callback, void* user_data);
+
+#if defined(MOD_PLAYER_THREADS)
+// for playing from an audio callback. decoding costs more in the blocks where a line starts, so a callback that
+// calls modplayer_decode_frames() itself can underrun. an async player decodes ahead on a thread of its own, into
+// a lock free ring buffer, and the callback only copies out of it with modplayer_async_read().
+typedef struct mp_async_player mp_async_player;
+
+// start decoding a player on a new thread. the ring holds buffer_frames frames (rounded up to a power of 2),
+// which is also the most latency it adds. the thread tops the ring up whenever fewer than watermark frames are
+// left in it, so watermark is how much the callback has left to play while the thread catches up (0 means
+// half the ring). the ring is filled before this returns. until modplayer_async_free(), the only thing that
+// may be called on the player is modplayer_post_command(). returns NULL if there isn't enough memory, or
+// the thread couldn't be started
+mp_async_player* modplayer_async_create(mp_mod_player* modplayer, unsigned int buffer_frames, unsigned int watermark);
+// stop the thread and free the async player. the player is left alone, and can be used directly again
+void modplayer_async_free(mp_async_player* async);
+// copy frame_count frames out of the ring as 16 bit. this never blocks or allocates, so it's safe in an audio
+// callback (from one thread at a time). if the ring runs out, the rest of the buffer is filled with silence and
+// counted as an underrun. returns the number of frames that came from the ring
+unsigned int modplayer_async_read(mp_async_player* async, unsigned int frame_count, short* buffer);
+// as above, but output 32-bit float values
+unsigned int modplayer_async_read_f(mp_async_player* async, unsigned int frame_count, float* buffer);
+// the number of frames decoded ahead right now
+unsigned int modplayer_async_buffered_frames(mp_async_player* async);
+// the number of reads that ran out of frames, and the frames of silence they filled in. either pointer can be NULL
+void modplayer_async_get_underruns(mp_async_player* async, unsigned int* underruns, unsigned int* underrun_frames);
+#endif // MOD_PLAYER_THREADS
+
+#if defined(MOD_PLAYER_STATS)
+// what a player has done since it was created, or since modplayer_reset_stats()
+typedef struct mp_stats
+{
+	unsigned long long lines;			// lines executed, including the ones stepped through by seeking
+	unsigned long long ticks;			// ticks executed after the first one of each line
+	unsigned long long frames_mixed;	// output frames mixed
+	unsigned long long channel_frames[MP_MAX_CHANNELS];	// frames each channel was mixed for (silent
+										// channels only have their position moved on, so they aren't counted)
+	unsigned long long voice_frames;	// the sum of channel_frames. voice_frames / frames_mixed is the
+										// average number of channels playing
+	unsigned int active_voices;			// channels mixed in the last mixing pass
+	unsigned int peak_active_voices;	// the most channels mixed at once
+	unsigned long long loop_wraps;		// times a sample got to its loop end and went back to the loop start
+	unsigned long long clipped_samples;	// output values beyond full scale (clipped for 16 bit output)
+} mp_stats;
+
+// the stages a timing hook is called around
+typedef enum mp_timing_stage
+{
+	MP_STAGE_LINE,	// executing a line: notes and effects
+	MP_STAGE_TICK,	// executing the effects on the other ticks of a line
+	MP_STAGE_MIX	// mixing the channels for a run of frames
+} mp_timing_stage;
+
+// called with end=false before each stage and end=true after it
+typedef void (*mp_timing_hook)(void* user_data, mp_timing_stage stage, bool end);
+
+// the player's stats. the pointer stays valid as long as the player
+const mp_stats* modplayer_get_stats(mp_mod_player* modplayer);
+// set all of the stats back to 0
+void modplayer_reset_stats(mp_mod_player* modplayer);
+// set (or with hook=NULL, clear) the timing hook. modplayer_render_song() calls it from its threads as well,
+// so with MOD_PLAYER_THREADS the hook has to be thread safe
+void modplayer_set_timing_hook(mp_mod_player* modplayer, mp_timing_hook hook, void* user_data);
+#endif // MOD_PLAYER_STATS
 
 #ifdef __cplusplus
 }
@@ -87,12 +436,123 @@ void modplayer_decode_frames_f(mp_mod_player* modplayer, unsigned int frame_coun
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(MOD_PLAYER_NO_MMAP)
+	#if defined(_WIN32)
+		#include <windows.h>
+	#else
+		#include <sys/mman.h>
+		#include <sys/stat.h>
+		#include <fcntl.h>
+		#include <unistd.h>
+	#endif
+#endif
+
+#if defined(MP_MALLOC) && defined(MP_FREE)
+	// using your own allocator
+#elif !defined(MP_MALLOC) && !defined(MP_FREE)
+	#define MP_MALLOC(size) malloc(size)
+	#define MP_FREE(ptr) free(ptr)
+#else
+	#error "Define both MP_MALLOC and MP_FREE, or neither of them"
+#endif
+
+// round a size up so the next part of a single allocation is 16 byte aligned
+#define MP_BLOCK_ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+// for the few functions that are only worth having once they're inlined with constant arguments, see mix_voice()
+#if defined(_MSC_VER)
+	#define MP_ALWAYS_INLINE __forceinline
+#elif defined(__GNUC__)
+	#define MP_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+	#define MP_ALWAYS_INLINE inline
+#endif
+
+// atomics on unsigned ints, for the command queue and the async player's ring. loads acquire, stores release,
+// and mp_atomic_cas() does both. it works like C11's compare_exchange: on failure *expected gets the current value
+#if defined(_MSC_VER)
+	#include <intrin.h>
+	#define mp_atomic_load(p) ((unsigned int)_InterlockedOr((volatile long*)(p), 0))
+	#define mp_atomic_store(p, v) _InterlockedExchange((volatile long*)(p), (long)(v))
+	static inline bool mp_atomic_cas(unsigned int* p, unsigned int* expected, unsigned int desired)
+	{
+		unsigned int old = (unsigned int)_InterlockedCompareExchange((volatile long*)p, (long)desired, (long)*expected);
+		bool swapped = old == *expected;
+		*expected = old;
+		return swapped;
+	}
+#else
+	#define mp_atomic_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+	#define mp_atomic_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+	static inline bool mp_atomic_cas(unsigned int* p, unsigned int* expected, unsigned int desired)
+	{
+		return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	}
+#endif
+
+#if defined(MOD_PLAYER_THREADS)
+	#if defined(_WIN32)
+		#include <windows.h>
+	#else
+		#include <pthread.h>
+		#include <poll.h> // for sleeping: nanosleep and usleep aren't declared in strict c99
+	#endif
+#endif
+
+#if !defined(MOD_PLAYER_NO_SIMD)
+	#if defined(__AVX2__)
+		#define MP_SIMD_AVX2
+		#include <immintrin.h>
+	#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define MP_SIMD_SSE2
+		#include <emmintrin.h>
+	#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		#define MP_SIMD_NEON
+		#include <arm_neon.h>
+	#endif
+#endif
+
 typedef struct mp_pattern mp_pattern;
-typedef struct mp_line mp_line;
 typedef struct mp_channel_note mp_channel_note;
 typedef struct mp_channel_state mp_channel_state;
 typedef struct mp_sample mp_sample;
-typedef struct mp_mod mp_mod;
+typedef struct mp_seek_index mp_seek_index;
+typedef struct mp_render_cache mp_render_cache;
+
+#ifdef MOD_PLAYER_FLOAT_SAMPLES
+typedef float mp_sample_t;
+#define MP_SAMPLE_SCALE 1.0f
+#else
+// samples stay as the signed 8 bit pcm from the mod file. the kernels convert them as they mix
+typedef signed char mp_sample_t;
+#define MP_SAMPLE_SCALE (1.0f / 128.0f)
+#endif
+
+// sample positions are 32.32 fixed point: the sample index in the top 32 bits, the fraction below it.
+// stepping is exact, so a voice never drifts however long it plays for, and it plays the same however
+// the decoding is split up
+typedef unsigned long long mp_position_t;
+#define mp_position_from_int(i) ((mp_position_t)(i) << 32)
+#define mp_position_index(p) ((int)((p) >> 32))
+
+#ifdef MOD_PLAYER_FIXED_POINT
+#ifdef MOD_PLAYER_FLOAT_SAMPLES
+	#error "MOD_PLAYER_FIXED_POINT interpolates the 8 bit samples with integer maths, so it can't be used with MOD_PLAYER_FLOAT_SAMPLES"
+#endif
+// bits of the fraction used for interpolating, small enough for a 16 bit multiply
+#define MP_FRAC_BITS 15
+#define MP_INTERP_SCALE (1.0f / (1 << MP_FRAC_BITS))
+#else
+#define MP_INTERP_SCALE 1.0f
+#endif
+
+// every loaded sample has this many (silent) values in front of it, so the vector kernels
+// can load a whole 32 bit word that ends on the first byte of the sample
+#define MP_SAMPLE_PADDING 4
+// samples the mod owns (i.e. copied rather than borrowed) are followed by this many guard values: a copy of
+// the loop start, or silence if the sample doesn't loop. interpolation can read past the end without checking,
+// as far as the widest mode (MP_INTERPOLATION_SINC) reaches. the padding in front covers its reads before the start
+#define MP_SAMPLE_GUARD 4
 
 struct mp_sample
 {
@@ -102,26 +562,29 @@ struct mp_sample
 	char fine_tune;
 	unsigned char loop;
 	unsigned char volume;
+	unsigned char guarded; // 1 if the sample data is followed by MP_SAMPLE_GUARD guard values
 	char name[23];
-	float* sample_data;
+	mp_sample_t* sample_data;
 };
 
+// one non-empty cell of a pattern
 struct mp_channel_note
 {
 	unsigned short period;
 	unsigned char sample;
 	unsigned char effect_type;
 	unsigned char effect_param;
+	unsigned char channel;
+	unsigned char flags; // NoteFlag values, worked out when the pattern is loaded
 };
 
-struct mp_line
-{
-	mp_channel_note channels[4];
-};
-
+// patterns only store the cells that have something in them, line by line. empty cells
+// don't do anything except end the effects left running by the line before, see execute_line()
 struct mp_pattern
 {
-	mp_line lines[64];
+	mp_channel_note* notes;
+	unsigned short line_start[65]; // the notes on line i are notes[line_start[i]] up to notes[line_start[i+1]-1]
+	unsigned int channel_mask[64]; // the channels with a note on each line
 };
 
 struct mp_channel_state
@@ -151,11 +614,13 @@ struct mp_channel_state
 	unsigned char loop_start;
 	unsigned char loop_count;
 
-	float pitch_offset; // in semi-tones. used for vibrato and arpeggio effects
+	short pitch_offset; // in MP_PITCH_UNITS (1/64ths of a semitone). used for vibrato and arpeggio effects
 	unsigned short target_period; // target period for slide-to-note effect
 
-	float sample_pos;
+	mp_position_t sample_pos;
 	float panning; // -1 hard left, +1 hard right
+	float gain_left; // output gains from the panning and stereo settings, see update_channel_gains()
+	float gain_right;
 };
 
 struct mp_mod
@@ -168,8 +633,23 @@ struct mp_mod
 	mp_sample* samples;
 	mp_pattern* patterns;
 	unsigned char pattern_table[128];
+
+	// false if the sample data points into the mod file rather than separate allocations
+	bool owns_sample_data;
+	unsigned char* file_data; // the file loaded by modplayer_mod_create_from_file(), if the samples point into it
+	unsigned char* mapped_data; // the mapping made by modplayer_mod_create_from_file_mapped()
+	size_t mapped_size;
 };
 
+// a slot in the command queue, see mp_mod_player
+typedef struct mp_command
+{
+	unsigned int sequence;
+	int type;
+	int arg;
+	float value;
+} mp_command;
+
 struct mp_mod_player
 {
 	// settings
@@ -179,14 +659,30 @@ struct mp_mod_player
 	// 1=mono, 2=stereo. (other values not currently supported)
 	// default is stereo.
 	unsigned int output_channel_count;
+	// samples per output frame at a period of 1, i.e. Amiga clock / (2 * output_sample_rate). kept up to date by
+	// modplayer_set_sample_rate(), so a channel's step is just this times its pitch ratio, over its period
+	float step_per_period;
 	// by default channels 1&4 are mixed hard left and channels 2,3 are mixed hard right
 	// use this to reduce the stereo width if you prefer
 	// default is 1.0 (= hard panning). 0.0 = mono
 	// only useful if output_channel_count = 2
 	float stereo_width;
+	// see modplayer_set_interpolation(). default is MP_INTERPOLATION_LINEAR
+	mp_interpolation interpolation;
+	// a bit for each channel muted with modplayer_set_channel_muted()
+	unsigned int muted_mask;
+
+	// commands posted by other threads, see modplayer_post_command(). a bounded queue with a sequence number
+	// in each slot (after Dmitry Vyukov's): a slot at queue position pos is free for posting when its
+	// sequence is pos, and holds a posted command when it's pos+1. posters claim positions by moving
+	// command_head on with a compare and swap, and only the decoding thread moves command_tail
+	mp_command commands[MP_COMMAND_QUEUE_SIZE];
+	unsigned int command_head;
+	unsigned int command_tail;
 
 	// mod to play
 	mp_mod* mod;
+	bool owns_mod; // true if the mod was loaded for this player, and should be free'd with it
 
 	// data relating to current play position etc
 	int pattern_idx;
@@ -198,14 +694,96 @@ struct mp_mod_player
 	int bpm;
 
 	bool do_position_jump; // if true, do a position jump after the current line
+	bool position_jump_is_loop; // true if the jump comes from a pattern loop (E6) rather than a break or jump
 	int position_jump_pat_idx;
 	int position_jump_line_idx;
 
 	int pattern_delay; // used for pattern-delay effect (EE)
+	unsigned int line_channel_mask; // the channels with a note on the current line
+
+	unsigned long long position_frames; // number of frames played since the start of the song
+	bool on_song_timeline; // false after a straight jump to an order, when position_frames counts from the jump instead
+
+	mp_channel_state* channel_state; // allocated along with the player
+
+	mp_seek_index* seek_index; // NULL until modplayer_build_seek_index() is called
+	mp_render_cache* render_cache; // NULL unless modplayer_set_render_cache() has been called
+
+	mp_event_callback event_callback; // see modplayer_set_event_callback()
+	void* event_user_data;
+	bool event_pending; // the player is at the start of a tick the event callback hasn't been told about yet
+	int pending_events; // the SequencerEvent values of the move to that tick
 
-	mp_channel_state* channel_state;
-	float* mix_buffer;
-	float* final_buffer;
+#if defined(MOD_PLAYER_STATS)
+	mp_stats stats;
+	mp_timing_hook timing_hook;
+	void* timing_user_data;
+#endif
+};
+
+// MP_STATS(statement) only runs the statement when the stats are compiled in, and MP_TIMING() calls the timing hook
+#if defined(MOD_PLAYER_STATS)
+	#define MP_STATS(statement) statement
+	#define MP_TIMING(modplayer, stage, end) do { if((modplayer)->timing_hook != NULL) (modplayer)->timing_hook((modplayer)->timing_user_data, stage, end); } while(0)
+#else
+	#define MP_STATS(statement)
+	#define MP_TIMING(modplayer, stage, end) do { } while(0)
+#endif
+
+// a snapshot of the player state, everything needed to carry on playing from a given point in the song
+typedef struct mp_checkpoint
+{
+	unsigned long long position_frames;
+	int pattern_idx;
+	int line_idx;
+	int tick_idx;
+	int frames_until_next_tick;
+	int speed;
+	int bpm;
+	bool do_position_jump;
+	bool position_jump_is_loop;
+	int position_jump_pat_idx;
+	int position_jump_line_idx;
+	int pattern_delay;
+	unsigned int line_channel_mask;
+	bool on_song_timeline;
+	bool event_pending;
+	int pending_events;
+	mp_channel_state* channel_state; // one per channel in the mod. this includes the pattern loop counters
+} mp_checkpoint;
+
+// checkpoints at the start of each order, in the order they're played
+struct mp_seek_index
+{
+	unsigned int sample_rate; // frame positions depend on the sample rate, so the index is rebuilt if it changes
+	int num_checkpoints;
+	mp_checkpoint checkpoints[128]; // their channel states are allocated along with the index
+};
+
+// the lines of the song played so far, one bit per line for each order. the song has finished
+// (and is about to repeat) when it gets back to a line it has already played
+typedef struct mp_line_history
+{
+	unsigned long long visited[128];
+	int lines_left;
+} mp_line_history;
+
+// things that can happen when the sequencer moves on a tick, see next_tick()
+enum SequencerEvent
+{
+	SeqEvent_NewLine		= 0x1,
+	SeqEvent_NewOrder		= 0x2,
+	SeqEvent_PatternLoop	= 0x4,
+	SeqEvent_SongLoop		= 0x8
+};
+
+// how a note changes its channel at the start of a line, decided when the pattern is loaded
+enum NoteFlag
+{
+	NoteFlag_Trigger			= 0x1, // starts a new note (or restarts the sample)
+	NoteFlag_ResetVibPhase		= 0x2, // restarts the vibrato/tremolo wave, if the note triggers
+	NoteFlag_KeepPitchSlide		= 0x4, // carries on the slide-to-note from earlier lines (5xy)
+	NoteFlag_KeepVibrato		= 0x8  // carries on the vibrato from earlier lines (6xy)
 };
 
 enum EffectType
@@ -252,27 +830,27 @@ enum ExtendedEffectType
 #define mp_max(a,b) ((a) > (b) ? (a) : (b))
 #define mp_clamp(x, a,b)  ((x) < (a) ? (a) : (x) > (b) ? (b) : (x))
 
-#ifndef M_PI
-#define M_PI 3.14159265f
-#endif
+// a float of our own rather than M_PI, which is a double where the system headers define it, and would
+// change the vibrato depending on what was included before the implementation
+#define MP_PI 3.14159265f
 #define TAU 6.28318531f
 
 static inline float mp_sin(float x)
 {
 	// wrap input angle to -pi..pi
-	if(x > M_PI)
+	if(x > MP_PI)
 	{
 		x = x * (1.0f / TAU);
 		x = x - (int)x; // get fractional part of x
 		x *= TAU;
-		x = x > M_PI ? x - TAU : x;
+		x = x > MP_PI ? x - TAU : x;
 	}
-	else if (x < -M_PI)
+	else if (x < -MP_PI)
 	{
 		x = -x * (1.0f / TAU);
 		x = x - (int)x;
 		x *= -TAU;
-		x = x < -M_PI ? x + TAU : x;
+		x = x < -MP_PI ? x + TAU : x;
 	}
 
 	// parametric sin approximation (not especially accurate, but good enough for vibrato)
@@ -282,12 +860,46 @@ static inline float mp_sin(float x)
 		return 1.27323954f * x - 0.405284735f * x * x;
 }
 
-static inline float mp_pow2(float x)
+// the clock the Amiga's sample rates are derived from. a channel plays at MP_AMIGA_CLOCK / (2 * period) hz
+#define MP_AMIGA_CLOCK 7159090.5f
+
+// pitch offsets (fine tune, arpeggio and vibrato) are in 1/64ths of a semitone
+#define MP_PITCH_UNITS 64
+
+// 2^(n/12), the frequency ratio for each semitone of an octave
+static const float mp_semitone_ratio[12] =
+{
+	1.000000000f, 1.059463094f, 1.122462048f, 1.189207115f, 1.259921050f, 1.334839854f,
+	1.414213562f, 1.498307077f, 1.587401052f, 1.681792831f, 1.781797436f, 1.887748625f
+};
+
+// 2^(n/768), the frequency ratio for each 1/64th of a semitone
+static const float mp_fine_pitch_ratio[MP_PITCH_UNITS] =
 {
-	// cubic approximation for 2^x
-	// only valid for x values from -1 .. 1
-	x = mp_clamp(x, -1.0f, 1.0f);
-	return 0.9988f + x*(0.6927f + x*(0.2503f + x*0.0572f));
+	1.000000000f, 1.000902943f, 1.001806701f, 1.002711275f, 1.003616666f, 1.004522874f, 1.005429901f, 1.006337747f,
+	1.007246412f, 1.008155898f, 1.009066205f, 1.009977334f, 1.010889286f, 1.011802061f, 1.012715661f, 1.013630085f,
+	1.014545335f, 1.015461411f, 1.016378315f, 1.017296046f, 1.018214607f, 1.019133996f, 1.020054216f, 1.020975266f,
+	1.021897149f, 1.022819863f, 1.023743411f, 1.024667793f, 1.025593009f, 1.026519061f, 1.027445949f, 1.028373674f,
+	1.029302237f, 1.030231638f, 1.031161878f, 1.032092958f, 1.033024879f, 1.033957641f, 1.034891246f, 1.035825694f,
+	1.036760985f, 1.037697121f, 1.038634102f, 1.039571929f, 1.040510603f, 1.041450125f, 1.042390495f, 1.043331714f,
+	1.044273782f, 1.045216702f, 1.046160473f, 1.047105096f, 1.048050572f, 1.048996902f, 1.049944086f, 1.050892125f,
+	1.051841021f, 1.052790773f, 1.053741383f, 1.054692851f, 1.055645178f, 1.056598366f, 1.057552413f, 1.058507323f
+};
+
+// the frequency ratio for a pitch offset in MP_PITCH_UNITS, i.e. 2^(offset / (12 * MP_PITCH_UNITS)).
+// of any size: whole octaves are exact powers of two
+static float pitch_ratio(int offset)
+{
+	int units_per_octave = 12 * MP_PITCH_UNITS;
+	int octave = offset >= 0 ? offset / units_per_octave : -((units_per_octave - 1 - offset) / units_per_octave);
+	int units = offset - octave * units_per_octave;
+
+	float ratio = mp_semitone_ratio[units / MP_PITCH_UNITS] * mp_fine_pitch_ratio[units % MP_PITCH_UNITS];
+	for(; octave > 0; --octave)
+		ratio *= 2.0f;
+	for(; octave < 0; ++octave)
+		ratio *= 0.5f;
+	return ratio;
 }
 
 static inline unsigned char lower_nibble(unsigned char c)
@@ -314,34 +926,165 @@ static void read_sample(mp_sample* sam, unsigned char* data)
 	sam->volume = data[25];
 	sam->repeat_offset = read_short_big_endian(&data[26]) * 2;
 	sam->repeat_length = read_short_big_endian(&data[28]) * 2;
+	// some mods have loops that run past the end of the sample. clip them, so we never read past the sample data
+	if(sam->repeat_offset >= sam->length)
+		sam->repeat_length = 0;
+	else if(sam->repeat_offset + sam->repeat_length > sam->length)
+		sam->repeat_length = sam->length - sam->repeat_offset;
 	sam->loop = sam->repeat_length > 2 ? 1 : 0;
 }
 
-static void read_pattern(mp_pattern* pat, unsigned char* data)
+static bool is_digit(unsigned char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// the number of channels for the 4 character signature at offset 1080 of a mod, or 0 if it's a number we
+// can't play (none, or more than MP_MAX_CHANNELS). flt8 is set for startrekker's FLT8, which stores each
+// pattern as two 4 channel halves.
+// anything not recognised is taken to be a 4 channel mod, as M.K. is
+static int read_channel_count(const unsigned char* mk, bool* flt8)
+{
+	int num_channels = 4;
+	*flt8 = memcmp(mk, "FLT8", 4) == 0;
+	if(*flt8 || memcmp(mk, "CD81", 4) == 0 || memcmp(mk, "OKTA", 4) == 0 || memcmp(mk, "OCTA", 4) == 0)
+		num_channels = 8;
+	else if(is_digit(mk[0]) && memcmp(&mk[1], "CHN", 3) == 0) // 2CHN to 9CHN
+		num_channels = mk[0] - '0';
+	else if(is_digit(mk[0]) && is_digit(mk[1]) && (memcmp(&mk[2], "CH", 2) == 0 || memcmp(&mk[2], "CN", 2) == 0)) // 10CH to 32CH
+		num_channels = (mk[0] - '0') * 10 + (mk[1] - '0');
+	else if(memcmp(mk, "TDZ", 3) == 0 && is_digit(mk[3])) // TDZ1 to TDZ3
+		num_channels = mk[3] - '0';
+
+	return num_channels <= MP_MAX_CHANNELS ? num_channels : 0;
+}
+
+// the 64 lines of pattern number i, each line the 4 bytes of every channel in turn. FLT8 patterns are
+// put back together in scratch (2048 bytes) from their two halves, channels 1-4 then channels 5-8
+static unsigned char* pattern_lines(unsigned char* pattern_data, int i, int num_channels, bool flt8, unsigned char* scratch)
+{
+	unsigned char* data = &pattern_data[256 * num_channels * i];
+	if(!flt8)
+		return data;
+
+	for(int line=0; line<64; ++line)
+	{
+		memcpy(&scratch[32 * line], &data[16 * line], 16);
+		memcpy(&scratch[32 * line + 16], &data[1024 + 16 * line], 16);
+	}
+	return scratch;
+}
+
+// a cell is empty when all four of its bytes are zero: no note, no sample and no effect
+static bool is_empty_cell(unsigned char* data)
+{
+	return (data[0] | data[1] | data[2] | data[3]) == 0;
+}
+
+static int count_pattern_notes(unsigned char* data, int num_channels)
+{
+	int num_notes = 0;
+	for(int i=0; i<64 * num_channels; ++i)
+	{
+		if(!is_empty_cell(data))
+			num_notes++;
+		data += 4;
+	}
+	return num_notes;
+}
+
+// read a pattern, keeping only its non-empty cells. notes needs room for count_pattern_notes() of them.
+// the cell's sample number has 8 bits, so numbers past the mod's samples are read as 0 (no sample)
+static void read_pattern(mp_pattern* pat, mp_channel_note* notes, unsigned char* data, int num_channels, int num_samples)
 {
+	int num_notes = 0;
+	pat->notes = notes;
 	for(int i=0; i<64; ++i)
 	{
-		mp_line* line = &pat->lines[i];
-		for(int c=0; c<4; ++c)
+		pat->line_start[i] = num_notes;
+		pat->channel_mask[i] = 0;
+		for(int c=0; c<num_channels; ++c)
 		{
-			mp_channel_note* note = &line->channels[c];
-			note->sample = (data[0] & 0xf0) | ((data[2] & 0xf0) >> 4);
-			note->period = ((data[0] & 0x0f) << 8) | (data[1]);
-			note->effect_type = (data[2] & 0x0f);
-			note->effect_param = data[3];
+			if(!is_empty_cell(data))
+			{
+				mp_channel_note* note = &notes[num_notes++];
+				note->sample = (data[0] & 0xf0) | ((data[2] & 0xf0) >> 4);
+				if(note->sample >= num_samples)
+					note->sample = 0;
+				note->period = ((data[0] & 0x0f) << 8) | (data[1]);
+				note->effect_type = (data[2] & 0x0f);
+				note->effect_param = data[3];
+				note->channel = c;
+
+				note->flags = 0;
+				if((note->period != 0 || note->sample != 0) && note->effect_type != Effect_SlideToNote)
+					note->flags |= NoteFlag_Trigger;
+				if(	note->effect_type != Effect_Vibrato &&
+					note->effect_type != Effect_Tremolo &&
+					note->effect_type != Effect_VolSlide_Vib )
+					note->flags |= NoteFlag_ResetVibPhase;
+				if(note->effect_type == Effect_VolSlide_Port)
+					note->flags |= NoteFlag_KeepPitchSlide;
+				if(note->effect_type == Effect_VolSlide_Vib)
+					note->flags |= NoteFlag_KeepVibrato;
+
+				pat->channel_mask[i] |= 1u << c;
+			}
 
 			data += 4;
 		}
 	}
+	pat->line_start[64] = num_notes;
+}
+
+// work out the pan gains for every channel. only needs calling when the output settings change
+static void update_channel_gains(mp_mod_player* modplayer)
+{
+	float channel_gain = modplayer->output_channel_count / (float)modplayer->mod->num_channels;
+
+	for(int i=0; i<modplayer->mod->num_channels; ++i)
+	{
+		mp_channel_state* state = &modplayer->channel_state[i];
+		if(modplayer->output_channel_count == 1)
+		{
+			state->gain_left = channel_gain;
+			state->gain_right = 0.0f;
+		}
+		else
+		{
+			// simple linear panning
+			float panning = mp_clamp(state->panning * modplayer->stereo_width, -1.0f, 1.0f);
+			state->gain_left = channel_gain * (0.5f + 0.5f * -panning);
+			state->gain_right = channel_gain * (0.5f + 0.5f * panning);
+		}
+	}
 }
 
 static mp_mod_player* modplayer_create_player(mp_mod* mod)
 {
-	mp_mod_player* modplayer = (mp_mod_player*)malloc(sizeof(mp_mod_player));
+	// the player and its channel states are one allocation
+	int num_channels = mod->num_channels;
+	size_t channels_offset = MP_BLOCK_ALIGN(sizeof(mp_mod_player));
+	unsigned char* block = (unsigned char*)MP_MALLOC(channels_offset + sizeof(mp_channel_state) * num_channels);
+	if(block == NULL)
+	{
+		fprintf(stderr, "Error creating mod player, out of memory\n");
+		return NULL;
+	}
+
+	mp_mod_player* modplayer = (mp_mod_player*)block;
 	modplayer->output_sample_rate = 48000;
+	modplayer->step_per_period = MP_AMIGA_CLOCK / (2.0f * 48000);
 	modplayer->output_channel_count = 2;
 	modplayer->stereo_width = 1.0f;
+	modplayer->interpolation = MP_INTERPOLATION_LINEAR;
+	modplayer->muted_mask = 0;
+	for(unsigned int i=0; i<MP_COMMAND_QUEUE_SIZE; ++i)
+		modplayer->commands[i].sequence = i;
+	modplayer->command_head = 0;
+	modplayer->command_tail = 0;
 	modplayer->mod = mod;
+	modplayer->owns_mod = false;
 
 	modplayer->pattern_idx = 0;
 	modplayer->line_idx = 0;
@@ -352,12 +1095,24 @@ static mp_mod_player* modplayer_create_player(mp_mod* mod)
 	modplayer->bpm = 125;
 
 	modplayer->do_position_jump = false;
+	modplayer->position_jump_is_loop = false;
 	modplayer->pattern_delay = 0;
-
-	int num_channels = mod->num_channels;
-	modplayer->channel_state = (mp_channel_state*)malloc(sizeof(mp_channel_state) * num_channels);
-	modplayer->mix_buffer = (float*)malloc(sizeof(float) * 1024);
-	modplayer->final_buffer = (float*)malloc(sizeof(float) * 1024 * num_channels);
+	modplayer->line_channel_mask = 0;
+	modplayer->position_frames = 0;
+	modplayer->on_song_timeline = true;
+
+	modplayer->channel_state = (mp_channel_state*)(block + channels_offset);
+	modplayer->seek_index = NULL;
+	modplayer->render_cache = NULL;
+	modplayer->event_callback = NULL;
+	modplayer->event_user_data = NULL;
+	modplayer->event_pending = false;
+	modplayer->pending_events = 0;
+#if defined(MOD_PLAYER_STATS)
+	memset(&modplayer->stats, 0x00, sizeof(mp_stats));
+	modplayer->timing_hook = NULL;
+	modplayer->timing_user_data = NULL;
+#endif
 	for(int i=0; i<num_channels; ++i)
 	{
 		mp_channel_state* state = &modplayer->channel_state[i];
@@ -413,6 +1168,7 @@ static void execute_extended_effect(mp_mod_player* modplayer, mp_channel_note* n
 					modplayer->position_jump_line_idx = state->loop_start;
 					modplayer->position_jump_pat_idx = modplayer->pattern_idx;
 					modplayer->do_position_jump = true;
+					modplayer->position_jump_is_loop = true;
 				}
 			}
 			break;
@@ -452,6 +1208,14 @@ static void execute_extended_effect(mp_mod_player* modplayer, mp_channel_note* n
 	}
 }
 
+// the line a pattern break (Dxy) goes to. the parameter is in decimal, and protracker goes
+// to the first line for anything past the last one
+static int pattern_break_line(unsigned char effect_x, unsigned char effect_y)
+{
+	int line = effect_x * 10 + effect_y;
+	return line < 64 ? line : 0;
+}
+
 static void execute_effect(mp_mod_player* modplayer, mp_channel_note* note, mp_channel_state* state)
 {
 	unsigned char effect_val = note->effect_param;
@@ -505,7 +1269,7 @@ static void execute_effect(mp_mod_player* modplayer, mp_channel_note* note, mp_c
 			break;
 		case Effect_SetSampleOffset:
 			if(effect_val > 0)
-				state->sample_pos = 256.0f * effect_val;
+				state->sample_pos = mp_position_from_int(256 * effect_val);
 			break;
 		case Effect_VolSlide:
 		case Effect_VolSlide_Port:
@@ -521,6 +1285,7 @@ static void execute_effect(mp_mod_player* modplayer, mp_channel_note* note, mp_c
 				modplayer->position_jump_line_idx = 0;
 			modplayer->position_jump_pat_idx = effect_val;
 			modplayer->do_position_jump = true;
+			modplayer->position_jump_is_loop = false;
 			break;
 		case Effect_SetVolume:
 			state->volume = effect_val;
@@ -528,8 +1293,9 @@ static void execute_effect(mp_mod_player* modplayer, mp_channel_note* note, mp_c
 		case Effect_PatternBreak:
 			if(!modplayer->do_position_jump) // don't overwrite pattern info from a pos-jump command on the same line
 				modplayer->position_jump_pat_idx = modplayer->pattern_idx + 1;
-			modplayer->position_jump_line_idx = effect_x * 10 + effect_y;
+			modplayer->position_jump_line_idx = pattern_break_line(effect_x, effect_y);
 			modplayer->do_position_jump = true;
+			modplayer->position_jump_is_loop = false;
 			break;
 		case Effect_Extended:
 			execute_extended_effect(modplayer, note, state);
@@ -549,64 +1315,94 @@ static void execute_effect(mp_mod_player* modplayer, mp_channel_note* note, mp_c
 	}
 }
 
+// effects are active only for the line they appear on. flags says which running effects a new note keeps
+static void end_line_effects(mp_channel_state* state, unsigned char flags)
+{
+	state->vol_slide_active = 0;
+	state->tremolo_active = 0;
+	state->arpeggio_active = 0;
+	state->vol_offset = 0;
+	state->retrigger_rate = 0;
+	state->note_cut_idx = 0;
+	if((flags & NoteFlag_KeepPitchSlide) == 0)
+		state->pitch_slide_active = 0;
+	if((flags & NoteFlag_KeepVibrato) == 0)
+	{
+		state->vibrato_active = 0;
+		state->pitch_offset = 0;
+	}
+}
+
+// the length of a tick at a tempo
+static int tick_length(unsigned int sample_rate, int bpm)
+{
+	float seconds_per_tick = 1.0f / (0.4f * bpm);
+	return (int)(sample_rate * seconds_per_tick);
+}
+
+// the length of a tick at the current tempo
+static int frames_per_tick(const mp_mod_player* modplayer)
+{
+	return tick_length(modplayer->output_sample_rate, modplayer->bpm);
+}
+
 static void execute_line(mp_mod_player* modplayer)
 {
+	MP_TIMING(modplayer, MP_STAGE_LINE, false);
+	MP_STATS(modplayer->stats.lines++);
+
 	mp_mod* mod = modplayer->mod;
 
 	int pattern_idx = mod->pattern_table[modplayer->pattern_idx];
 	mp_pattern* pattern = &mod->patterns[pattern_idx];
-	mp_line* line = &pattern->lines[modplayer->line_idx];
+	int line_idx = modplayer->line_idx;
+	unsigned int channel_mask = pattern->channel_mask[line_idx];
 
-	int num_channels = mod->num_channels;
-	for(int i=0; i<num_channels; ++i)
+	// an empty cell only has to stop whatever its channel was doing on the line before. a channel
+	// that was empty on that line too has nothing left running, so it doesn't need touching at all
+	unsigned int ended_mask = modplayer->line_channel_mask & ~channel_mask;
+	for(int i=0; ended_mask != 0; ++i, ended_mask >>= 1)
 	{
-		mp_channel_note* note = &line->channels[i];
-		mp_channel_state* state = &modplayer->channel_state[i];
+		if(ended_mask & 1)
+			end_line_effects(&modplayer->channel_state[i], 0);
+	}
+	modplayer->line_channel_mask = channel_mask;
 
-		// effects are active only for the line they appear on.
-		state->vol_slide_active = 0;
-		state->tremolo_active = 0;
-		state->arpeggio_active = 0;
-		state->vol_offset = 0;
-		state->retrigger_rate = 0;
-		state->note_cut_idx = 0;
-		if(note->effect_type != Effect_VolSlide_Port)	
-			state->pitch_slide_active = 0;
-		if(note->effect_type != Effect_VolSlide_Vib)
-		{
-			state->vibrato_active = 0;
-			state->pitch_offset = 0.0f;
-		}
-			
-		if((note->period != 0 || note->sample != 0) &&
-			 note->effect_type != Effect_SlideToNote)
+	mp_channel_note* line_end = &pattern->notes[pattern->line_start[line_idx + 1]];
+	for(mp_channel_note* note = &pattern->notes[pattern->line_start[line_idx]]; note != line_end; ++note)
+	{
+		mp_channel_state* state = &modplayer->channel_state[note->channel];
+
+		end_line_effects(state, note->flags);
+
+		if(note->flags & NoteFlag_Trigger)
 		{
 			// trigger new note
 			if(note->period != 0)
 				state->period = note->period;
 			if(note->sample != 0)
 				state->sample = note->sample;
-			state->sample_pos = 0.0f;
+			state->sample_pos = 0;
 			state->sample_looped = 0;
 			state->volume = mod->samples[state->sample].volume;
 
-			if(	note->effect_type != Effect_Vibrato && 
-				note->effect_type != Effect_Tremolo && 	
-				note->effect_type != Effect_VolSlide_Vib )
-			{
+			if(note->flags & NoteFlag_ResetVibPhase)
 				state->vib_phase = 0; // reset vibrato/trem wave
-			}
 		}
 
 		execute_effect(modplayer, note, state);
 	}
 
-	float seconds_per_tick = 1.0f / (0.4f * modplayer->bpm);
-	modplayer->frames_until_next_tick = (int)(modplayer->output_sample_rate * seconds_per_tick);
+	modplayer->frames_until_next_tick = frames_per_tick(modplayer);
+
+	MP_TIMING(modplayer, MP_STAGE_LINE, true);
 }
 
 static void execute_tick(mp_mod_player* modplayer)
 {
+	MP_TIMING(modplayer, MP_STAGE_TICK, false);
+	MP_STATS(modplayer->stats.ticks++);
+
 	mp_mod* mod = modplayer->mod;
 
 	// handle currently playing effects
@@ -638,384 +1434,3124 @@ static void execute_tick(mp_mod_player* modplayer)
 		if(state->arpeggio_active != 0)
 		{
 			int tick_idx = modplayer->tick_idx % 3;
-			state->pitch_offset = tick_idx == 0 ? 0.0f : tick_idx == 1 ? state->arpeggio1 : state->arpeggio2;
+			int semitones = tick_idx == 0 ? 0 : tick_idx == 1 ? state->arpeggio1 : state->arpeggio2;
+			state->pitch_offset = semitones * MP_PITCH_UNITS;
 		}
 
 		if(state->vibrato_active != 0 || state->tremolo_active != 0)
 		{
 			state->vib_phase++;
 			float osc_per_tick = state->vib_rate * (1.0f / 64.0f);
-			float wave = mp_sin(state->vib_phase * osc_per_tick * 2.0f * M_PI);
+			float wave = mp_sin(state->vib_phase * osc_per_tick * 2.0f * MP_PI);
 
 			if(state->vibrato_active != 0)
-				state->pitch_offset = wave * state->vib_depth * (1.0f / 16.0f);
+			{
+				// the depth is in 1/16ths of a semitone
+				float offset = wave * state->vib_depth * (MP_PITCH_UNITS / 16.0f);
+				state->pitch_offset = (short)(offset < 0.0f ? offset - 0.5f : offset + 0.5f);
+			}
 			else
+			{
 				state->vol_offset = (char)(wave * state->vib_depth);
+			}
 		}
 
 		if(state->retrigger_rate > 0)
 		{
 			if(modplayer->tick_idx % state->retrigger_rate == 0)
-				state->sample_pos = 0.0f;
+				state->sample_pos = 0;
 		}
 
 		if(state->note_cut_idx != 0 && state->note_cut_idx == modplayer->tick_idx)
 			state->volume = 0;
 	}
 
-	float seconds_per_tick = 1.0f / (0.4f * modplayer->bpm);
-	modplayer->frames_until_next_tick = (int)(modplayer->output_sample_rate * seconds_per_tick);
+	modplayer->frames_until_next_tick = frames_per_tick(modplayer);
+
+	MP_TIMING(modplayer, MP_STAGE_TICK, true);
 }
 
-static void output_channel(mp_mod_player* modplayer, mp_channel_state* state, unsigned int num_frames, float* buffer)
+// position of frame i of a span. the steps are exact, so this is the same as adding step i times
+static inline mp_position_t span_position(mp_position_t pos, mp_position_t step, unsigned int i)
 {
-	int min_valid_period = 20; // this is to stop badly formed mods from playing sounds when they shouldn't (e.g. setting a sample but no period, then doing a pitch slide. some mods do it...)
-	if(state->sample > 0 && state->period > min_valid_period)
-	{
-		mp_sample* sample = &modplayer->mod->samples[state->sample];
-		float sample_pos = state->sample_pos;
-		// magic formula for converting from period to sample rate: 
-		// rate in hz = Amiga chip freq / 2*period
-		float sample_rate = 7159090.5f / (state->period * 2.0f);
-		if(state->pitch_offset != 0.0f || sample->fine_tune != 0)
-		{
-			float semitones = state->pitch_offset + (sample->fine_tune * (1.0f / 8.0f));
-			sample_rate *= mp_pow2(semitones * (1.0f / 12.0f));
-		}
-		
-		float sample_step = sample_rate / modplayer->output_sample_rate;
-		for(unsigned int i=0; i<num_frames; ++i)
-		{
-			int sample_end = state->sample_looped > 0 ? sample->repeat_offset + sample->repeat_length : sample->length;
-		
-			if(sample_pos < sample_end)
-			{
-				int idx = (int)sample_pos;
-				float t = sample_pos - idx;
-				// interpolate between adjacent samples
-				float s0 = sample->sample_data[idx];
-				float s1 = sample->sample_data[mp_min(idx + 1, sample_end-1)];
-				float sample_val = s0 + t * (s1 - s0);
-				unsigned char volume = state->volume + state->vol_offset;
-				volume = mp_min(volume, 64);
-				sample_val *= (volume * (1.0f / 64.0f));
-									
-				buffer[i] = sample_val;
-				sample_pos += sample_step;
-
-				// handle sample loop
-				if(sample_pos >= sample_end && sample->loop > 0)
-				{
-					float over = sample_pos - sample_end;
-					sample_pos = sample->repeat_offset + over;
-					state->sample_looped = 1;
-				}
-			}
-			else
-			{
-				buffer[i] = 0.0f;
-			}			
-		}
+	return pos + i * step;
+}
 
-		state->sample_pos = sample_pos;
-	}
-	else
-	{
-		for(unsigned int i=0; i<num_frames; ++i)
-			buffer[i] = 0.0f;
-	}
+// number of frames (up to max_frames) that can be resampled from pos before reaching sample_end
+static unsigned int frames_before_end(mp_position_t pos, mp_position_t step, mp_position_t sample_end, unsigned int max_frames)
+{
+	if(pos >= sample_end)
+		return 0;
+	mp_position_t n = (sample_end - pos + step - 1) / step;
+	return n < max_frames ? (unsigned int)n : max_frames;
 }
 
-static void mix_buffer(mp_mod_player* modplayer, float* channel_buffer, float* out_buffer, unsigned int num_frames, float panning)
+// everything a kernel needs to resample one span of a channel and mix it into the output
+typedef struct mp_span
 {
-	float channel_gain = modplayer->output_channel_count / (float)modplayer->mod->num_channels;
+	const mp_sample_t* data;
+	mp_position_t pos;		// sample position of the first frame of the span
+	mp_position_t step;		// sample positions per output frame
+	float gain;				// channel volume, including the MP_SAMPLE_SCALE conversion to -1..1 (and MP_INTERP_SCALE for linear)
+	float gain_left;		// pan gains. mono output only uses gain_left
+	float gain_right;
+} mp_span;
+
+// the fractional part of a position, as a float from 0 up to (not including) 1. 24 bits of it, so it's exact
+static inline float span_fraction(mp_position_t p)
+{
+	return (float)((unsigned int)p >> 8) * (1.0f / 16777216.0f);
+}
+
+#if defined(MOD_PLAYER_FIXED_POINT)
+// linearly interpolate between s0 and s1 at position p, and scale by the channel volume. the interpolation
+// is all integer: the result is the sample value scaled up by 1 << MP_FRAC_BITS, which converts to float exactly
+static inline float span_lerp(const mp_span* span, mp_position_t p, int s0, int s1)
+{
+	int frac = (int)(p >> (32 - MP_FRAC_BITS)) & ((1 << MP_FRAC_BITS) - 1);
+	int v = s0 * (1 << MP_FRAC_BITS) + (s1 - s0) * frac;
+	return (float)v * span->gain;
+}
+
+// frame i of a span, interpolated from the sample at its position to the one after it
+static inline float span_sample(const mp_span* span, unsigned int i)
+{
+	mp_position_t p = span_position(span->pos, span->step, i);
+	int idx = (int)(p >> 32);
+	return span_lerp(span, p, span->data[idx], span->data[idx + 1]);
+}
+#else
+// linearly interpolate between s0 and s1 at position p, and scale by the channel volume
+static inline float span_lerp(const mp_span* span, mp_position_t p, float s0, float s1)
+{
+	float t = span_fraction(p);
+	return (s0 + t * (s1 - s0)) * span->gain;
+}
+
+// frame i of a span, interpolated from the sample at its position to the one after it
+static inline float span_sample(const mp_span* span, unsigned int i)
+{
+	mp_position_t p = span_position(span->pos, span->step, i);
+	int idx = mp_position_index(p);
+	return span_lerp(span, p, span->data[idx], span->data[idx + 1]);
+}
+#endif
 
-	if(modplayer->output_channel_count == 1)
+// resample frames first..num_frames-1 of a span and mix them into the interleaved output buffer. the kernels
+// read the sample after each frame's position without checking, so the span must stop where that read would
+// go past the sample data (or the guard after it). there is no loop handling in here either.
+static inline void resample_mix_span_scalar(const mp_span* span, unsigned int out_channels, unsigned int first, unsigned int num_frames, float* buffer)
+{
+	if(out_channels == 1)
 	{
-		// mono output
-		for(unsigned int i=0; i<num_frames; ++i)
-		{
-			out_buffer[i] += channel_gain * channel_buffer[i];
-		}
+		for(unsigned int i=first; i<num_frames; ++i)
+			buffer[i] += span->gain_left * span_sample(span, i);
 	}
-	else if(modplayer->output_channel_count == 2)
+	else
 	{
-		// simple linear panning
-		panning = mp_clamp(panning * modplayer->stereo_width, -1.0f, 1.0f);
-		float left_gain = channel_gain * (0.5f + 0.5f * -panning);
-		float right_gain = channel_gain * (0.5f + 0.5f * panning);
-		
-		for(unsigned int i=0; i<num_frames; ++i)
+		for(unsigned int i=first; i<num_frames; ++i)
 		{
-			out_buffer[i*2+0] += left_gain * channel_buffer[i];
-			out_buffer[i*2+1] += right_gain * channel_buffer[i];
+			float sample_val = span_sample(span, i);
+			buffer[i*2+0] += span->gain_left * sample_val;
+			buffer[i*2+1] += span->gain_right * sample_val;
 		}
 	}
 }
 
-static void output_frames(mp_mod_player* modplayer, unsigned int num_frames, float* buffer)
+// how far each interpolation mode reads around the sample at a frame's position: mp_taps_before samples
+// before it and mp_taps_after after it. (indexed by mp_interpolation)
+static const int mp_taps_before[] = { 0, 0, 1, 3 };
+static const int mp_taps_after[] = { 0, 1, 2, 4 };
+
+// catmull-rom spline between s[1] and s[2] at t, using s[0] and s[3] for the slopes
+static inline float interpolate_cubic(const mp_sample_t* s, float t)
 {
-	mp_mod* mod = modplayer->mod;
-	
-	unsigned int num_channels = mod->num_channels;
-	unsigned int out_channels = modplayer->output_channel_count;
-	memset(buffer, 0x00, num_frames * out_channels * sizeof(float));
-	
-	for(unsigned int i=0; i<num_channels; ++i)
-	{
-		mp_channel_state* state = &modplayer->channel_state[i];
+	float a = 0.5f * (s[3] - s[0]) + 1.5f * (s[1] - s[2]);
+	float b = s[0] - 2.5f * s[1] + 2.0f * s[2] - 0.5f * s[3];
+	float c = 0.5f * (s[2] - s[0]);
+	return ((a * t + b) * t + c) * t + s[1];
+}
 
-		memset(modplayer->mix_buffer, 0x00, num_frames * sizeof(float));
-		
-		output_channel(modplayer, state, num_frames, modplayer->mix_buffer);
-		mix_buffer(modplayer, modplayer->mix_buffer, buffer, num_frames, state->panning);
-	}				
+// sin(pi * x) for x in 0..0.5, good to about 1e-7 (unlike mp_sin)
+static inline float sin_pi(float x)
+{
+	float z = x * x;
+	return x * (3.14159265f + z * (-5.16771278f + z * (2.55016404f + z * (-0.599264530f + z * (0.0821458867f + z * -0.00737043094f)))));
 }
 
-////////////// Public Interface ////////////////
+// (-1)^m * cos(m * pi/4) and (-1)^m * sin(m * pi/4) for m = -4..3, see interpolate_sinc()
+static const float mp_lanczos_cos[8] = { -1.0f, 0.70710678f, 0.0f, -0.70710678f, 1.0f, -0.70710678f, 0.0f, 0.70710678f };
+static const float mp_lanczos_sin[8] = { 0.0f, 0.70710678f, -1.0f, 0.70710678f, 0.0f, -0.70710678f, 1.0f, -0.70710678f };
 
-mp_mod_player* modplayer_create_from_file(char* filename)
+// lanczos (a = 4) interpolation of the 8 samples s[0..7] at t, between s[3] and s[4].
+// the weight of the sample at distance x+m from the position is sin(pi*(x+m)) * sin(pi*(x+m)/4) / (x+m)^2,
+// and sin(pi*(x+m)) = (-1)^m * sin(pi*x), so every weight comes from the same three sines. x is the distance
+// to the nearest sample, so the window sine for it never loses precision. the weights are normalised to sum to 1
+static inline float interpolate_sinc(const mp_sample_t* s, float t)
 {
-	FILE* fp = fopen(filename, "rb");
-
-	if(fp == NULL)
+	bool mirror = t > 0.5f;
+	float x = mirror ? 1.0f - t : t;
+	if(x < 1e-6f)
+		return mirror ? s[4] : s[3];
+
+	float sin_x = sin_pi(x);
+	float sin_w = sin_pi(0.25f * x);
+	float cos_w = sin_pi(0.5f - 0.25f * x);
+
+	float sum = 0.0f;
+	float weight_sum = 0.0f;
+	for(int m=-4; m<4; ++m)
 	{
-		fprintf(stderr, "Error opening mod file %s\n", filename);
-		return NULL;
+		float d = x + m;
+		float weight = sin_x * (sin_w * mp_lanczos_cos[m + 4] + cos_w * mp_lanczos_sin[m + 4]) / (d * d);
+		sum += weight * s[mirror ? m + 4 : 3 - m];
+		weight_sum += weight;
 	}
-
-	fseek(fp, 0, SEEK_END);
-	size_t len = ftell(fp);
-	rewind(fp);
-
-	unsigned char* buf = (unsigned char*)malloc(len);
-	fread(buf, len, 1, fp);
-	fclose(fp);
-
-	mp_mod_player* modplayer = modplayer_create_from_buffer(buf, (unsigned int)len);
-	free(buf);
-	return modplayer;
+	return sum / weight_sum;
 }
 
-mp_mod_player* modplayer_create_from_buffer(unsigned char* buf, unsigned int buflen)
+// interpolate at position p from taps, the samples from mp_taps_before before it to mp_taps_after after it,
+// and scale by the channel volume
+static inline float span_interpolate(const mp_span* span, mp_interpolation interpolation, mp_position_t p, const mp_sample_t* taps)
 {
-	if(buflen < 2048)
+	switch(interpolation)
 	{
-		fprintf(stderr, "This doesn't look like a mod file: too short\n");
-		return NULL;
+	case MP_INTERPOLATION_NEAREST:
+		return taps[0] * span->gain;
+	case MP_INTERPOLATION_CUBIC:
+		return interpolate_cubic(taps, span_fraction(p)) * span->gain;
+	case MP_INTERPOLATION_SINC:
+		return interpolate_sinc(taps, span_fraction(p)) * span->gain;
+	default:
+		return span_lerp(span, p, taps[0], taps[1]);
 	}
+}
 
-	mp_mod* mod = (mp_mod*)malloc(sizeof(mp_mod));
-	mod->name = (char*)malloc(21 * sizeof(char));
-
-	memcpy(mod->name, buf, 20);
-	mod->name[21] = '\0';
-
-	mod->num_channels = 4; // until we support xm
-
-	int num_samples = 32;
-	mod->num_samples = num_samples;
-	mod->samples = (mp_sample*)malloc(num_samples * sizeof(mp_sample));
-	memset(mod->samples, 0x00, num_samples * sizeof(mp_sample));
-	unsigned int sample_data_size = 0;
-	unsigned char* sample_def_data = &buf[20];
-	// samples are numbered from 1. sample 0 is always blank
-	for(int i=1; i<num_samples; ++i)
+// resample frames first..num_frames-1 of a span with one of the modes that only has a scalar kernel.
+// it's inlined into resample_mix_span_interpolated() for each mode, so the switch in span_interpolate() goes away
+static inline void resample_mix_span_filtered(const mp_span* span, mp_interpolation interpolation, unsigned int out_channels, unsigned int first, unsigned int num_frames, float* buffer)
+{
+	int before = mp_taps_before[interpolation];
+	if(out_channels == 1)
 	{
-		read_sample(&mod->samples[i], sample_def_data);
-		sample_def_data += 30;
-		sample_data_size += mod->samples[i].length;
+		for(unsigned int i=first; i<num_frames; ++i)
+		{
+			mp_position_t p = span_position(span->pos, span->step, i);
+			buffer[i] += span->gain_left * span_interpolate(span, interpolation, p, &span->data[mp_position_index(p) - before]);
+		}
 	}
-
-	unsigned char* song_data = sample_def_data;
-	mod->song_length = song_data[0];
-	memcpy(mod->pattern_table, &song_data[2], 128);
-
-	int num_patterns = 0;
-	for(int i=0; i<mod->song_length; ++i)
+	else
 	{
-		int patternIdx = mod->pattern_table[i] + 1;
-		num_patterns = mp_max(patternIdx, num_patterns);
+		for(unsigned int i=first; i<num_frames; ++i)
+		{
+			mp_position_t p = span_position(span->pos, span->step, i);
+			float sample_val = span_interpolate(span, interpolation, p, &span->data[mp_position_index(p) - before]);
+			buffer[i*2+0] += span->gain_left * sample_val;
+			buffer[i*2+1] += span->gain_right * sample_val;
+		}
+	}
+}
+
+// sample i of a channel as playback sees it: silence before the start and, from end_idx on, whatever plays
+// next, which is the loop start or silence
+static inline mp_sample_t sample_tap(const mp_sample* sample, int end_idx, int i)
+{
+	if(i < 0)
+		return 0;
+	if(i < end_idx)
+		return sample->sample_data[i];
+	return sample->loop > 0 ? sample->sample_data[sample->repeat_offset + (i - end_idx) % sample->repeat_length] : 0;
+}
+
+// resample frames first..num_frames-1 of a span whose interpolation would read outside the sample data
+// (past end_idx, when there's no guard there, or before the start): each sample is read with sample_tap()
+static void resample_mix_checked(const mp_span* span, mp_interpolation interpolation, const mp_sample* sample, int end_idx, unsigned int out_channels, unsigned int first, unsigned int num_frames, float* buffer)
+{
+	int before = mp_taps_before[interpolation];
+	int num_taps = before + 1 + mp_taps_after[interpolation];
+	for(unsigned int i=first; i<num_frames; ++i)
+	{
+		mp_position_t p = span_position(span->pos, span->step, i);
+		int idx = mp_position_index(p) - before;
+
+		mp_sample_t taps[8];
+		for(int k=0; k<num_taps; ++k)
+			taps[k] = sample_tap(sample, end_idx, idx + k);
+
+		float sample_val = span_interpolate(span, interpolation, p, taps);
+		if(out_channels == 1)
+		{
+			buffer[i] += span->gain_left * sample_val;
+		}
+		else
+		{
+			buffer[i*2+0] += span->gain_left * sample_val;
+			buffer[i*2+1] += span->gain_right * sample_val;
+		}
+	}
+}
+
+// the vector kernels walk a span with a cursor: span_cursor_xxx() starts it at frame 0, and each
+// span_next_xxx() returns the next 4 (or 8) frames, exactly as span_sample() would produce them
+
+#if defined(MP_SIMD_SSE2)
+typedef struct mp_cursor_sse2
+{
+	__m128i pos01; // 32.32 positions of the next four frames, two per register
+	__m128i pos23;
+} mp_cursor_sse2;
+
+static inline mp_cursor_sse2 span_cursor_sse2(const mp_span* span)
+{
+	mp_cursor_sse2 cursor;
+	cursor.pos01 = _mm_set_epi64x((long long)(span->pos + span->step), (long long)span->pos);
+	cursor.pos23 = _mm_set_epi64x((long long)(span->pos + 3 * span->step), (long long)(span->pos + 2 * span->step));
+	return cursor;
+}
+
+// the sample indices of the next four frames, which are the high halves of their positions, and the
+// low halves (the fractions) in frac. moves the cursor on
+static inline __m128i span_advance_sse2(const mp_span* span, mp_cursor_sse2* cursor, __m128i* frac)
+{
+	__m128 pos01 = _mm_castsi128_ps(cursor->pos01);
+	__m128 pos23 = _mm_castsi128_ps(cursor->pos23);
+	__m128i idx = _mm_castps_si128(_mm_shuffle_ps(pos01, pos23, _MM_SHUFFLE(3, 1, 3, 1)));
+	*frac = _mm_castps_si128(_mm_shuffle_ps(pos01, pos23, _MM_SHUFFLE(2, 0, 2, 0)));
+
+	__m128i step4 = _mm_set1_epi64x((long long)(4 * span->step));
+	cursor->pos01 = _mm_add_epi64(cursor->pos01, step4);
+	cursor->pos23 = _mm_add_epi64(cursor->pos23, step4);
+	return idx;
+}
+
+#if defined(MOD_PLAYER_FIXED_POINT)
+static inline __m128 span_next_sse2(const mp_span* span, mp_cursor_sse2* cursor)
+{
+	const mp_sample_t* data = span->data;
+
+	__m128i frac;
+	__m128i idx = span_advance_sse2(span, cursor, &frac);
+	frac = _mm_srli_epi32(frac, 32 - MP_FRAC_BITS);
+
+	int idxs[4];
+	_mm_storeu_si128((__m128i*)idxs, idx);
+	__m128i s0 = _mm_setr_epi32(data[idxs[0]], data[idxs[1]], data[idxs[2]], data[idxs[3]]);
+	__m128i s1 = _mm_setr_epi32(data[idxs[0] + 1], data[idxs[1] + 1], data[idxs[2] + 1], data[idxs[3] + 1]);
+
+	// s1-s0 fits in 16 bits and the fraction is under 1 << 15, so a 16 bit multiply-add gives (s1-s0)*frac
+	__m128i v = _mm_add_epi32(_mm_slli_epi32(s0, MP_FRAC_BITS), _mm_madd_epi16(_mm_sub_epi32(s1, s0), frac));
+
+	return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(span->gain));
+}
+#else
+static inline __m128 gather_sse2(const mp_sample_t* data, int i0, int i1, int i2, int i3)
+{
+#ifdef MOD_PLAYER_FLOAT_SAMPLES
+	return _mm_setr_ps(data[i0], data[i1], data[i2], data[i3]);
+#else
+	return _mm_cvtepi32_ps(_mm_setr_epi32(data[i0], data[i1], data[i2], data[i3]));
+#endif
+}
+
+static inline __m128 span_next_sse2(const mp_span* span, mp_cursor_sse2* cursor)
+{
+	const mp_sample_t* data = span->data;
+
+	__m128i frac;
+	__m128i idx = span_advance_sse2(span, cursor, &frac);
+	// the top 24 bits of the fraction, the same as span_fraction()
+	__m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(frac, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+
+	int idxs[4];
+	_mm_storeu_si128((__m128i*)idxs, idx);
+	__m128 s0 = gather_sse2(data, idxs[0], idxs[1], idxs[2], idxs[3]);
+	__m128 s1 = gather_sse2(data, idxs[0] + 1, idxs[1] + 1, idxs[2] + 1, idxs[3] + 1);
+
+	__m128 v = _mm_add_ps(s0, _mm_mul_ps(t, _mm_sub_ps(s1, s0)));
+	return _mm_mul_ps(v, _mm_set1_ps(span->gain));
+}
+#endif
+
+static MP_ALWAYS_INLINE void resample_mix_span_sse2(const mp_span* span, unsigned int out_channels, unsigned int num_frames, float* buffer)
+{
+	const __m128 gain_left = _mm_set1_ps(span->gain_left);
+	const __m128 gain_right = _mm_set1_ps(span->gain_right);
+	mp_cursor_sse2 cursor = span_cursor_sse2(span);
+
+	unsigned int i = 0;
+	if(out_channels == 1)
+	{
+		for(; i+4 <= num_frames; i += 4)
+		{
+			__m128 v = span_next_sse2(span, &cursor);
+			_mm_storeu_ps(&buffer[i], _mm_add_ps(_mm_loadu_ps(&buffer[i]), _mm_mul_ps(gain_left, v)));
+		}
+	}
+	else
+	{
+		for(; i+4 <= num_frames; i += 4)
+		{
+			__m128 v = span_next_sse2(span, &cursor);
+			__m128 l = _mm_mul_ps(gain_left, v);
+			__m128 r = _mm_mul_ps(gain_right, v);
+			float* out = &buffer[i*2];
+			_mm_storeu_ps(&out[0], _mm_add_ps(_mm_loadu_ps(&out[0]), _mm_unpacklo_ps(l, r)));
+			_mm_storeu_ps(&out[4], _mm_add_ps(_mm_loadu_ps(&out[4]), _mm_unpackhi_ps(l, r)));
+		}
+	}
+
+	resample_mix_span_scalar(span, out_channels, i, num_frames, buffer);
+}
+#endif
+
+#if defined(MP_SIMD_AVX2)
+#ifndef MOD_PLAYER_FLOAT_SAMPLES
+static inline __m256i gather_int_avx2(const mp_sample_t* data, __m256i idx)
+{
+	// there are no byte gathers, so load the 32 bit word that ends on each sample (the samples are
+	// padded in front, see MP_SAMPLE_PADDING), then shift the wanted byte down with sign extension
+	__m256i words = _mm256_i32gather_epi32((const int*)(data - 3), idx, 1);
+	return _mm256_srai_epi32(words, 24);
+}
+#endif
+
+typedef struct mp_cursor_avx2
+{
+	__m256i pos0123; // 32.32 positions of the next eight frames, four per register
+	__m256i pos4567;
+} mp_cursor_avx2;
+
+static inline mp_cursor_avx2 span_cursor_avx2(const mp_span* span)
+{
+	mp_cursor_avx2 cursor;
+	long long pos = (long long)span->pos;
+	long long step = (long long)span->step;
+	cursor.pos0123 = _mm256_setr_epi64x(pos, pos + step, pos + 2*step, pos + 3*step);
+	cursor.pos4567 = _mm256_add_epi64(cursor.pos0123, _mm256_set1_epi64x(4*step));
+	return cursor;
+}
+
+// the sample indices of the next eight frames, which are the high halves of their positions, and the
+// low halves (the fractions) in frac. moves the cursor on
+static inline __m256i span_advance_avx2(const mp_span* span, mp_cursor_avx2* cursor, __m256i* frac)
+{
+	// the shuffle works within 128 bit lanes, which leaves the pairs of frames in the order 0 1 4 5 2 3 6 7,
+	// so swap the middle pairs back
+	__m256 pos0123 = _mm256_castsi256_ps(cursor->pos0123);
+	__m256 pos4567 = _mm256_castsi256_ps(cursor->pos4567);
+	__m256i hi = _mm256_castps_si256(_mm256_shuffle_ps(pos0123, pos4567, _MM_SHUFFLE(3, 1, 3, 1)));
+	__m256i lo = _mm256_castps_si256(_mm256_shuffle_ps(pos0123, pos4567, _MM_SHUFFLE(2, 0, 2, 0)));
+	*frac = _mm256_permute4x64_epi64(lo, _MM_SHUFFLE(3, 1, 2, 0));
+
+	__m256i step8 = _mm256_set1_epi64x((long long)(8 * span->step));
+	cursor->pos0123 = _mm256_add_epi64(cursor->pos0123, step8);
+	cursor->pos4567 = _mm256_add_epi64(cursor->pos4567, step8);
+	return _mm256_permute4x64_epi64(hi, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+#if defined(MOD_PLAYER_FIXED_POINT)
+static inline __m256 span_next_avx2(const mp_span* span, mp_cursor_avx2* cursor)
+{
+	__m256i frac;
+	__m256i idx = span_advance_avx2(span, cursor, &frac);
+	frac = _mm256_srli_epi32(frac, 32 - MP_FRAC_BITS);
+
+	__m256i idx1 = _mm256_add_epi32(idx, _mm256_set1_epi32(1));
+	__m256i s0 = gather_int_avx2(span->data, idx);
+	__m256i s1 = gather_int_avx2(span->data, idx1);
+
+	// s1-s0 fits in 16 bits and the fraction is under 1 << 15, so a 16 bit multiply-add gives (s1-s0)*frac
+	__m256i v = _mm256_add_epi32(_mm256_slli_epi32(s0, MP_FRAC_BITS), _mm256_madd_epi16(_mm256_sub_epi32(s1, s0), frac));
+
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(span->gain));
+}
+#else
+static inline __m256 gather_avx2(const mp_sample_t* data, __m256i idx)
+{
+#ifdef MOD_PLAYER_FLOAT_SAMPLES
+	return _mm256_i32gather_ps(data, idx, 4);
+#else
+	return _mm256_cvtepi32_ps(gather_int_avx2(data, idx));
+#endif
+}
+
+static inline __m256 span_next_avx2(const mp_span* span, mp_cursor_avx2* cursor)
+{
+	__m256i frac;
+	__m256i idx = span_advance_avx2(span, cursor, &frac);
+	// the top 24 bits of the fraction, the same as span_fraction()
+	__m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(frac, 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+
+	__m256i idx1 = _mm256_add_epi32(idx, _mm256_set1_epi32(1));
+	__m256 s0 = gather_avx2(span->data, idx);
+	__m256 s1 = gather_avx2(span->data, idx1);
+
+	// keep the mul and add separate (no fma) so we match the scalar kernel exactly
+	__m256 v = _mm256_add_ps(s0, _mm256_mul_ps(t, _mm256_sub_ps(s1, s0)));
+	return _mm256_mul_ps(v, _mm256_set1_ps(span->gain));
+}
+#endif
+
+static MP_ALWAYS_INLINE void resample_mix_span_avx2(const mp_span* span, unsigned int out_channels, unsigned int num_frames, float* buffer)
+{
+	const __m256 gain_left = _mm256_set1_ps(span->gain_left);
+	const __m256 gain_right = _mm256_set1_ps(span->gain_right);
+	mp_cursor_avx2 cursor = span_cursor_avx2(span);
+
+	unsigned int i = 0;
+	if(out_channels == 1)
+	{
+		for(; i+8 <= num_frames; i += 8)
+		{
+			__m256 v = span_next_avx2(span, &cursor);
+			_mm256_storeu_ps(&buffer[i], _mm256_add_ps(_mm256_loadu_ps(&buffer[i]), _mm256_mul_ps(gain_left, v)));
+		}
+	}
+	else
+	{
+		for(; i+8 <= num_frames; i += 8)
+		{
+			__m256 v = span_next_avx2(span, &cursor);
+			__m256 l = _mm256_mul_ps(gain_left, v);
+			__m256 r = _mm256_mul_ps(gain_right, v);
+			// unpack works within 128 bit lanes, so swap the middle quarters back into frame order
+			__m256 lo = _mm256_unpacklo_ps(l, r); // l0 r0 l1 r1 | l4 r4 l5 r5
+			__m256 hi = _mm256_unpackhi_ps(l, r); // l2 r2 l3 r3 | l6 r6 l7 r7
+			float* out = &buffer[i*2];
+			_mm256_storeu_ps(&out[0], _mm256_add_ps(_mm256_loadu_ps(&out[0]), _mm256_permute2f128_ps(lo, hi, 0x20)));
+			_mm256_storeu_ps(&out[8], _mm256_add_ps(_mm256_loadu_ps(&out[8]), _mm256_permute2f128_ps(lo, hi, 0x31)));
+		}
+	}
+
+	resample_mix_span_scalar(span, out_channels, i, num_frames, buffer);
+}
+#endif
+
+#if defined(MP_SIMD_NEON)
+#ifndef MOD_PLAYER_FLOAT_SAMPLES
+static inline int32x4_t gather_int_neon(const mp_sample_t* data, const int* idxs)
+{
+	int values[4] = { data[idxs[0]], data[idxs[1]], data[idxs[2]], data[idxs[3]] };
+	return vld1q_s32(values);
+}
+#endif
+
+typedef struct mp_cursor_neon
+{
+	uint64x2_t pos01; // 32.32 positions of the next four frames, two per register
+	uint64x2_t pos23;
+} mp_cursor_neon;
+
+static inline mp_cursor_neon span_cursor_neon(const mp_span* span)
+{
+	mp_cursor_neon cursor;
+	cursor.pos01 = vcombine_u64(vcreate_u64(span->pos), vcreate_u64(span->pos + span->step));
+	cursor.pos23 = vcombine_u64(vcreate_u64(span->pos + 2 * span->step), vcreate_u64(span->pos + 3 * span->step));
+	return cursor;
+}
+
+// the sample indices of the next four frames, which are the high halves of their positions, and the
+// low halves (the fractions) in frac. moves the cursor on
+static inline int32x4_t span_advance_neon(const mp_span* span, mp_cursor_neon* cursor, uint32x4_t* frac)
+{
+	uint32x4_t hi = vcombine_u32(vshrn_n_u64(cursor->pos01, 32), vshrn_n_u64(cursor->pos23, 32));
+	*frac = vcombine_u32(vmovn_u64(cursor->pos01), vmovn_u64(cursor->pos23));
+
+	uint64x2_t step4 = vdupq_n_u64(4 * span->step);
+	cursor->pos01 = vaddq_u64(cursor->pos01, step4);
+	cursor->pos23 = vaddq_u64(cursor->pos23, step4);
+	return vreinterpretq_s32_u32(hi);
+}
+
+#if defined(MOD_PLAYER_FIXED_POINT)
+static inline float32x4_t span_next_neon(const mp_span* span, mp_cursor_neon* cursor)
+{
+	uint32x4_t lo;
+	int32x4_t idx = span_advance_neon(span, cursor, &lo);
+	int32x4_t frac = vreinterpretq_s32_u32(vshrq_n_u32(lo, 32 - MP_FRAC_BITS));
+
+	int idxs[4], idxs1[4];
+	vst1q_s32(idxs, idx);
+	vst1q_s32(idxs1, vaddq_s32(idx, vdupq_n_s32(1)));
+	int32x4_t s0 = gather_int_neon(span->data, idxs);
+	int32x4_t s1 = gather_int_neon(span->data, idxs1);
+
+	// integer multiply-accumulate is exact, so it matches the scalar kernel
+	int32x4_t v = vmlaq_s32(vshlq_n_s32(s0, MP_FRAC_BITS), vsubq_s32(s1, s0), frac);
+
+	return vmulq_f32(vcvtq_f32_s32(v), vdupq_n_f32(span->gain));
+}
+#else
+static inline float32x4_t gather_neon(const mp_sample_t* data, const int* idxs)
+{
+#ifdef MOD_PLAYER_FLOAT_SAMPLES
+	float values[4] = { data[idxs[0]], data[idxs[1]], data[idxs[2]], data[idxs[3]] };
+	return vld1q_f32(values);
+#else
+	return vcvtq_f32_s32(gather_int_neon(data, idxs));
+#endif
+}
+
+static inline float32x4_t span_next_neon(const mp_span* span, mp_cursor_neon* cursor)
+{
+	const mp_sample_t* data = span->data;
+
+	uint32x4_t frac;
+	int32x4_t idx = span_advance_neon(span, cursor, &frac);
+	// the top 24 bits of the fraction, the same as span_fraction()
+	float32x4_t t = vmulq_f32(vcvtq_f32_u32(vshrq_n_u32(frac, 8)), vdupq_n_f32(1.0f / 16777216.0f));
+
+	int idxs[4], idxs1[4];
+	vst1q_s32(idxs, idx);
+	vst1q_s32(idxs1, vaddq_s32(idx, vdupq_n_s32(1)));
+	float32x4_t s0 = gather_neon(data, idxs);
+	float32x4_t s1 = gather_neon(data, idxs1);
+
+	// vmulq + vaddq rather than vmlaq/vfmaq so we match the scalar kernel exactly
+	float32x4_t v = vaddq_f32(s0, vmulq_f32(t, vsubq_f32(s1, s0)));
+	return vmulq_f32(v, vdupq_n_f32(span->gain));
+}
+#endif
+
+static MP_ALWAYS_INLINE void resample_mix_span_neon(const mp_span* span, unsigned int out_channels, unsigned int num_frames, float* buffer)
+{
+	const float32x4_t gain_left = vdupq_n_f32(span->gain_left);
+	const float32x4_t gain_right = vdupq_n_f32(span->gain_right);
+	mp_cursor_neon cursor = span_cursor_neon(span);
+
+	unsigned int i = 0;
+	if(out_channels == 1)
+	{
+		for(; i+4 <= num_frames; i += 4)
+		{
+			float32x4_t v = span_next_neon(span, &cursor);
+			vst1q_f32(&buffer[i], vaddq_f32(vld1q_f32(&buffer[i]), vmulq_f32(gain_left, v)));
+		}
+	}
+	else
+	{
+		for(; i+4 <= num_frames; i += 4)
+		{
+			float32x4_t v = span_next_neon(span, &cursor);
+			// de-interleaving load/store, so left and right can be added separately
+			float32x4x2_t out = vld2q_f32(&buffer[i*2]);
+			out.val[0] = vaddq_f32(out.val[0], vmulq_f32(gain_left, v));
+			out.val[1] = vaddq_f32(out.val[1], vmulq_f32(gain_right, v));
+			vst2q_f32(&buffer[i*2], out);
+		}
+	}
+
+	resample_mix_span_scalar(span, out_channels, i, num_frames, buffer);
+}
+#endif
+
+static MP_ALWAYS_INLINE void resample_mix_span(const mp_span* span, unsigned int out_channels, unsigned int num_frames, float* buffer)
+{
+#if defined(MP_SIMD_AVX2)
+	resample_mix_span_avx2(span, out_channels, num_frames, buffer);
+#elif defined(MP_SIMD_SSE2)
+	resample_mix_span_sse2(span, out_channels, num_frames, buffer);
+#elif defined(MP_SIMD_NEON)
+	resample_mix_span_neon(span, out_channels, num_frames, buffer);
+#else
+	resample_mix_span_scalar(span, out_channels, 0, num_frames, buffer);
+#endif
+}
+
+// resample frames first..num_frames-1 of a span with the given interpolation. linear always starts at frame 0
+// (it reads nothing before a frame's position, so there's never a checked head to skip)
+static MP_ALWAYS_INLINE void resample_mix_span_interpolated(const mp_span* span, mp_interpolation interpolation, unsigned int out_channels, unsigned int first, unsigned int num_frames, float* buffer)
+{
+	switch(interpolation)
+	{
+	case MP_INTERPOLATION_NEAREST:
+		resample_mix_span_filtered(span, MP_INTERPOLATION_NEAREST, out_channels, first, num_frames, buffer);
+		break;
+	case MP_INTERPOLATION_CUBIC:
+		resample_mix_span_filtered(span, MP_INTERPOLATION_CUBIC, out_channels, first, num_frames, buffer);
+		break;
+	case MP_INTERPOLATION_SINC:
+		resample_mix_span_filtered(span, MP_INTERPOLATION_SINC, out_channels, first, num_frames, buffer);
+		break;
+	default:
+		resample_mix_span(span, out_channels, num_frames, buffer);
+		break;
+	}
+}
+
+// convert mixed frames to 16 bit, clipping anything too loud rather than letting it wrap around.
+// values are truncated toward zero like a plain cast, so the simd versions give exactly the same shorts
+static inline short convert_to_int16_scalar(float value)
+{
+	value *= 32767.0f;
+	value = value > 32767.0f ? 32767.0f : value;
+	value = value < -32768.0f ? -32768.0f : value;
+	return (short)value;
+}
+
+static void convert_to_int16(const float* buffer, unsigned int count, short* out)
+{
+	unsigned int i = 0;
+#if defined(MP_SIMD_AVX2)
+	const __m256 scale = _mm256_set1_ps(32767.0f);
+	const __m256 hi = _mm256_set1_ps(32767.0f);
+	const __m256 lo = _mm256_set1_ps(-32768.0f);
+	for(; i + 16 <= count; i += 16)
+	{
+		__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(&buffer[i]), scale), lo), hi);
+		__m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(&buffer[i + 8]), scale), lo), hi);
+		// the pack works within 128 bit lanes, so put the quarters back in order afterwards
+		__m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+		_mm256_storeu_si256((__m256i*)&out[i], _mm256_permute4x64_epi64(packed, 0xd8));
+	}
+#elif defined(MP_SIMD_SSE2)
+	const __m128 scale = _mm_set1_ps(32767.0f);
+	const __m128 hi = _mm_set1_ps(32767.0f);
+	const __m128 lo = _mm_set1_ps(-32768.0f);
+	for(; i + 8 <= count; i += 8)
+	{
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(&buffer[i]), scale), lo), hi);
+		__m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(&buffer[i + 4]), scale), lo), hi);
+		_mm_storeu_si128((__m128i*)&out[i], _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
+	}
+#elif defined(MP_SIMD_NEON)
+	const float32x4_t hi = vdupq_n_f32(32767.0f);
+	const float32x4_t lo = vdupq_n_f32(-32768.0f);
+	for(; i + 8 <= count; i += 8)
+	{
+		float32x4_t a = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(&buffer[i]), 32767.0f), lo), hi);
+		float32x4_t b = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(&buffer[i + 4]), 32767.0f), lo), hi);
+		vst1q_s16(&out[i], vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a)), vqmovn_s32(vcvtq_s32_f32(b))));
+	}
+#endif
+	for(; i < count; ++i)
+		out[i] = convert_to_int16_scalar(buffer[i]);
+}
+
+// what mixing has to do for a channel, see channel_activity()
+enum ChannelActivity
+{
+	Channel_Off,		// nothing to play: no sample, a bad period, or a sample that has ended without looping
+	Channel_Silent,		// playing at zero volume. nothing is heard, but the sample position still moves on
+	Channel_Audible
+};
+
+static unsigned char channel_volume(const mp_channel_state* state)
+{
+	unsigned char volume = state->volume + state->vol_offset;
+	return mp_min(volume, 64);
+}
+
+static int channel_activity(mp_mod_player* modplayer, const mp_channel_state* state)
+{
+	int min_valid_period = 20; // this is to stop badly formed mods from playing sounds when they shouldn't (e.g. setting a sample but no period, then doing a pitch slide. some mods do it...)
+	if(state->sample == 0 || state->period <= min_valid_period)
+		return Channel_Off;
+
+	mp_sample* sample = &modplayer->mod->samples[state->sample];
+	if(sample->loop == 0 && !(state->sample_pos < mp_position_from_int(sample->length)))
+		return Channel_Off;
+
+	bool muted = (modplayer->muted_mask >> (state - modplayer->channel_state)) & 1;
+	return muted || channel_volume(state) == 0 ? Channel_Silent : Channel_Audible;
+}
+
+// mix num_frames of a voice into the interleaved output buffer, in spans that end at the sample (or loop) end
+// so the kernel never has to check for it, and move the voice on. looping is sample->loop > 0. every call
+// passes out_channels, interpolation and looping straight through, so the c++ build gets a copy of this for
+// each combination with the branches on them folded away, see mp_voice_mixers
+static MP_ALWAYS_INLINE void mix_voice(mp_mod_player* modplayer, mp_channel_state* state, mp_span span, unsigned int num_frames, float* buffer,
+	unsigned int out_channels, mp_interpolation interpolation, bool looping)
+{
+	mp_sample* sample = &modplayer->mod->samples[state->sample];
+	int taps_before = mp_taps_before[interpolation];
+	int taps_after = mp_taps_after[interpolation];
+
+	unsigned int frame = 0;
+	while(frame < num_frames)
+	{
+		int end_idx = looping && state->sample_looped > 0 ? sample->repeat_offset + sample->repeat_length : sample->length;
+		mp_position_t sample_end = mp_position_from_int(end_idx);
+		if(!(span.pos < sample_end))
+			break;
+
+		// the kernels read taps_before samples before each frame's position and taps_after after it, without
+		// checking. the padding in front of the sample data and the guard after it make that safe right up to
+		// the ends, but a borrowed sample has neither, and a loop can end before the end of the data. the
+		// frames whose reads would go outside are mixed by resample_mix_checked() instead
+		int readable_end = sample->guarded && end_idx == sample->length ? end_idx + MP_SAMPLE_GUARD : end_idx;
+		unsigned int span_frames = frames_before_end(span.pos, span.step, sample_end, num_frames - frame);
+		unsigned int kernel_end = frames_before_end(span.pos, span.step, mp_position_from_int(mp_max(readable_end - taps_after, 0)), span_frames);
+		unsigned int kernel_start = sample->guarded ? 0 : frames_before_end(span.pos, span.step, mp_position_from_int(taps_before), kernel_end);
+
+		if(buffer != NULL)
+		{
+			float* out = &buffer[frame * out_channels];
+			resample_mix_checked(&span, interpolation, sample, end_idx, out_channels, 0, kernel_start, out);
+			if(kernel_end > kernel_start)
+				resample_mix_span_interpolated(&span, interpolation, out_channels, kernel_start, kernel_end, out);
+			resample_mix_checked(&span, interpolation, sample, end_idx, out_channels, kernel_end, span_frames, out);
+#if defined(MOD_PLAYER_STATS)
+			modplayer->stats.channel_frames[state - modplayer->channel_state] += span_frames;
+			modplayer->stats.voice_frames += span_frames;
+#endif
+		}
+		span.pos = span_position(span.pos, span.step, span_frames);
+		frame += span_frames;
+
+		// handle sample loop
+		if(looping && span.pos >= sample_end)
+		{
+			mp_position_t over = span.pos - sample_end;
+			span.pos = mp_position_from_int(sample->repeat_offset) + over;
+			state->sample_looped = 1;
+			MP_STATS(modplayer->stats.loop_wraps++);
+		}
+	}
+
+	state->sample_pos = span.pos;
+}
+
+#if defined(__cplusplus)
+// the c++ build instantiates mix_voice() for every output channel count, interpolation mode and loop mode,
+// and output_channel() picks one once per channel per block, instead of the loops testing them per span and frame
+template<unsigned int OutChannels, mp_interpolation Interpolation, bool Looping>
+static void mix_voice_t(mp_mod_player* modplayer, mp_channel_state* state, mp_span span, unsigned int num_frames, float* buffer)
+{
+	mix_voice(modplayer, state, span, num_frames, buffer, OutChannels, Interpolation, Looping);
+}
+
+typedef void (*mp_voice_mixer)(mp_mod_player* modplayer, mp_channel_state* state, mp_span span, unsigned int num_frames, float* buffer);
+
+// indexed by [output_channel_count - 1][interpolation][looping]
+static const mp_voice_mixer mp_voice_mixers[2][4][2] =
+{
+	{
+		{ mix_voice_t<1, MP_INTERPOLATION_NEAREST, false>, mix_voice_t<1, MP_INTERPOLATION_NEAREST, true> },
+		{ mix_voice_t<1, MP_INTERPOLATION_LINEAR, false>, mix_voice_t<1, MP_INTERPOLATION_LINEAR, true> },
+		{ mix_voice_t<1, MP_INTERPOLATION_CUBIC, false>, mix_voice_t<1, MP_INTERPOLATION_CUBIC, true> },
+		{ mix_voice_t<1, MP_INTERPOLATION_SINC, false>, mix_voice_t<1, MP_INTERPOLATION_SINC, true> },
+	},
+	{
+		{ mix_voice_t<2, MP_INTERPOLATION_NEAREST, false>, mix_voice_t<2, MP_INTERPOLATION_NEAREST, true> },
+		{ mix_voice_t<2, MP_INTERPOLATION_LINEAR, false>, mix_voice_t<2, MP_INTERPOLATION_LINEAR, true> },
+		{ mix_voice_t<2, MP_INTERPOLATION_CUBIC, false>, mix_voice_t<2, MP_INTERPOLATION_CUBIC, true> },
+		{ mix_voice_t<2, MP_INTERPOLATION_SINC, false>, mix_voice_t<2, MP_INTERPOLATION_SINC, true> },
+	},
+};
+#endif
+
+// resample a channel and mix it straight into the interleaved output buffer. the channel mustn't be Channel_Off.
+// with a NULL buffer the voice is moved on exactly as if it had been mixed, which is what seeking uses
+static void output_channel(mp_mod_player* modplayer, mp_channel_state* state, unsigned int num_frames, float* buffer)
+{
+	unsigned int out_channels = modplayer->output_channel_count;
+	mp_sample* sample = &modplayer->mod->samples[state->sample];
+
+	// magic formula for converting from period to sample rate:
+	// rate in hz = Amiga chip freq / 2*period, see step_per_period. fine tune is in 1/8ths of a semitone
+	float step = modplayer->step_per_period / state->period;
+	int pitch_offset = state->pitch_offset + sample->fine_tune * (MP_PITCH_UNITS / 8);
+	if(pitch_offset != 0)
+		step *= pitch_ratio(pitch_offset);
+
+	unsigned char volume = channel_volume(state);
+	mp_interpolation interpolation = modplayer->interpolation;
+
+	mp_span span;
+	span.data = sample->sample_data;
+	span.pos = state->sample_pos;
+	span.step = (mp_position_t)((double)step * 4294967296.0);
+	span.step = mp_max(span.step, 1);
+	span.gain = volume * (1.0f / 64.0f) * MP_SAMPLE_SCALE * (interpolation == MP_INTERPOLATION_LINEAR ? MP_INTERP_SCALE : 1.0f);
+	span.gain_left = state->gain_left;
+	span.gain_right = state->gain_right;
+
+#if defined(__cplusplus)
+	mp_voice_mixers[out_channels - 1][interpolation][sample->loop > 0](modplayer, state, span, num_frames, buffer);
+#else
+	mix_voice(modplayer, state, span, num_frames, buffer, out_channels, interpolation, sample->loop > 0);
+#endif
+}
+
+// mix num_frames of every channel into buffer. if stems isn't NULL, each channel with a stems[i] is
+// written into stems[i] + stem_offset as well, see modplayer_decode_stems_f()
+static void mix_channels(mp_mod_player* modplayer, unsigned int num_frames, float* buffer, float** stems, unsigned int stem_offset)
+{
+	MP_TIMING(modplayer, MP_STAGE_MIX, false);
+
+	mp_mod* mod = modplayer->mod;
+
+	unsigned int num_channels = mod->num_channels;
+	unsigned int out_channels = modplayer->output_channel_count;
+	unsigned int num_values = num_frames * out_channels;
+	if(buffer != NULL)
+		memset(buffer, 0x00, num_values * sizeof(float));
+	for(unsigned int i=0; stems != NULL && i<num_channels; ++i)
+	{
+		if(stems[i] != NULL)
+			memset(stems[i] + stem_offset, 0x00, num_values * sizeof(float));
+	}
+
+	// sort the channels out first, so the ones with nothing to play cost nothing at all
+	unsigned int active_mask = 0;
+	unsigned int audible_mask = 0;
+	MP_STATS(unsigned int num_audible = 0);
+	for(unsigned int i=0; i<num_channels; ++i)
+	{
+		int activity = channel_activity(modplayer, &modplayer->channel_state[i]);
+		if(activity != Channel_Off)
+			active_mask |= 1u << i;
+		if(activity == Channel_Audible)
+			audible_mask |= 1u << i;
+		MP_STATS(num_audible += activity == Channel_Audible);
+	}
+
+#if defined(MOD_PLAYER_STATS)
+	if(buffer != NULL || stems != NULL)
+	{
+		mp_stats* stats = &modplayer->stats;
+		stats->frames_mixed += num_frames;
+		stats->active_voices = num_audible;
+		stats->peak_active_voices = mp_max(stats->peak_active_voices, num_audible);
+	}
+#endif
+
+	// silent channels are only moved on, as if they'd been mixed
+	for(unsigned int i=0; active_mask != 0; ++i, active_mask >>= 1, audible_mask >>= 1)
+	{
+		if(!(active_mask & 1))
+			continue;
+
+		float* stem = stems != NULL && stems[i] != NULL ? stems[i] + stem_offset : NULL;
+		if(stem == NULL)
+		{
+			output_channel(modplayer, &modplayer->channel_state[i], num_frames, (audible_mask & 1) ? buffer : NULL);
+			continue;
+		}
+
+		// a channel's stem is what it would have added to the mix
+		output_channel(modplayer, &modplayer->channel_state[i], num_frames, (audible_mask & 1) ? stem : NULL);
+		if(buffer != NULL && (audible_mask & 1))
+		{
+			for(unsigned int v=0; v<num_values; ++v)
+				buffer[v] += stem[v];
+		}
+	}
+
+	MP_TIMING(modplayer, MP_STAGE_MIX, true);
+}
+
+static void output_frames(mp_mod_player* modplayer, unsigned int num_frames, float* buffer)
+{
+	mix_channels(modplayer, num_frames, buffer, NULL, 0);
+}
+
+#if defined(MOD_PLAYER_STATS)
+// the number of values too loud for 16 bit output, see convert_to_int16()
+static unsigned int count_clipped(const float* buffer, unsigned int count)
+{
+	unsigned int clipped = 0;
+	for(unsigned int i=0; i<count; ++i)
+	{
+		float value = buffer[i] * 32767.0f;
+		clipped += value > 32767.0f || value < -32768.0f;
+	}
+	return clipped;
+}
+
+// add the stats from a copy of a player (see render_song()) to the stats of the player itself
+static void add_stats(mp_stats* stats, const mp_stats* from)
+{
+	stats->lines += from->lines;
+	stats->ticks += from->ticks;
+	stats->frames_mixed += from->frames_mixed;
+	for(int i=0; i<MP_MAX_CHANNELS; ++i)
+		stats->channel_frames[i] += from->channel_frames[i];
+	stats->voice_frames += from->voice_frames;
+	stats->active_voices = from->active_voices;
+	stats->peak_active_voices = mp_max(stats->peak_active_voices, from->peak_active_voices);
+	stats->loop_wraps += from->loop_wraps;
+	stats->clipped_samples += from->clipped_samples;
+}
+#endif
+
+// move to the next line (following any jumps) and run it. returns a mask of SequencerEvent values
+static int next_line(mp_mod_player* modplayer)
+{
+	int events = SeqEvent_NewLine;
+
+	modplayer->tick_idx = 0;
+	modplayer->pattern_delay = 0;
+	modplayer->line_idx++;
+
+	if(modplayer->do_position_jump || modplayer->line_idx >= 64) //modplayer->mod->patterns[modplayer->mod->pattern_table[modplayer->pattern_idx]].length)
+	{
+		int old_pattern_idx = modplayer->pattern_idx;
+
+		if(modplayer->do_position_jump)
+		{
+			modplayer->line_idx = modplayer->position_jump_line_idx;
+			modplayer->pattern_idx = modplayer->position_jump_pat_idx;
+			modplayer->do_position_jump = false;
+			if(modplayer->position_jump_is_loop)
+				events |= SeqEvent_PatternLoop;
+			modplayer->position_jump_is_loop = false;
+		}
+		else
+		{
+			modplayer->line_idx = 0;
+			modplayer->pattern_idx++;
+		}
+
+		if(modplayer->pattern_idx >= modplayer->mod->song_length)
+		{
+			// end of song;
+			modplayer->pattern_idx = 0; // loop
+			events |= SeqEvent_SongLoop;
+		}
+
+		if(modplayer->pattern_idx != old_pattern_idx)
+		{
+			events |= SeqEvent_NewOrder;
+			// new pattern, so reset the loop points
+			for(int i=0; i<modplayer->mod->num_channels; ++i)
+			{
+				modplayer->channel_state[i].loop_start = 0;
+				modplayer->channel_state[i].loop_count = 0;
+			}
+		}
+	}
+		
+	execute_line(modplayer);
+
+	return events;
+}
+
+// move the sequencer on at the end of a tick: either run the next tick of the current line,
+// or move to the next line and run that. returns a mask of SequencerEvent values
+static int next_tick(mp_mod_player* modplayer)
+{
+	int events = 0;
+	modplayer->tick_idx++;
+	if(modplayer->tick_idx == (modplayer->speed + modplayer->pattern_delay))
+		events = next_line(modplayer);
+	else
+		execute_tick(modplayer);
+
+	modplayer->event_pending = true;
+	modplayer->pending_events = events;
+	return events;
+}
+
+// play frame_count frames, running ticks as they come due. returns the SequencerEvent values that happened.
+// the frames go to buffer_f as floats, or to buffer as 16 bit. with neither buffer, the voices and
+// sequencer are stepped along without mixing anything.
+// 16 bit frames are mixed in the same pieces as float ones, so they come out the same as a float render
+// converted afterwards. each piece is converted as soon as it's mixed, while it's still in the cache
+static int play_frames(mp_mod_player* modplayer, unsigned int frame_count, float* buffer_f, short* buffer)
+{
+	float mix_buffer[1024 * 2];
+	unsigned int out_channels = modplayer->output_channel_count;
+
+	int events = 0;
+	unsigned int frames_remaining = frame_count;
+	float* out_buf_f = buffer_f;
+	short* out_buf = buffer;
+	while(frames_remaining > 0)
+	{
+		int num_frames = mp_min(frames_remaining, 1024);
+		num_frames = mp_min(modplayer->frames_until_next_tick, num_frames);
+
+		if(out_buf != NULL)
+		{
+			output_frames(modplayer, num_frames, mix_buffer);
+			MP_STATS(modplayer->stats.clipped_samples += count_clipped(mix_buffer, num_frames * out_channels));
+			convert_to_int16(mix_buffer, num_frames * out_channels, out_buf);
+			out_buf += num_frames * out_channels;
+		}
+		else
+		{
+			output_frames(modplayer, num_frames, out_buf_f);
+			if(out_buf_f != NULL)
+			{
+				MP_STATS(modplayer->stats.clipped_samples += count_clipped(out_buf_f, num_frames * out_channels));
+				out_buf_f += num_frames * out_channels;
+			}
+		}
+
+		modplayer->frames_until_next_tick -= num_frames;
+		modplayer->position_frames += num_frames;
+		modplayer->event_pending = false;
+		frames_remaining -= num_frames;
+
+		if(modplayer->frames_until_next_tick == 0)
+			events |= next_tick(modplayer);
+	}
+
+	return events;
+}
+
+// tell the event callback about a tick starting frame frames into the buffer of a decode call. events is
+// what the move to it returned (see next_tick()), and the player is on the line it's part of
+static void send_event(mp_mod_player* modplayer, int events, unsigned int frame, unsigned long long position_frames, int tick)
+{
+	mp_event event;
+	event.flags = MP_EVENT_TICK;
+	if(events & SeqEvent_NewLine)
+		event.flags |= MP_EVENT_LINE;
+	if(events & SeqEvent_NewOrder)
+		event.flags |= MP_EVENT_ORDER;
+	if(events & SeqEvent_PatternLoop)
+		event.flags |= MP_EVENT_PATTERN_LOOP;
+	if(events & SeqEvent_SongLoop)
+		event.flags |= MP_EVENT_SONG_LOOP;
+	event.frame = frame;
+	event.position_frames = position_frames;
+	event.order = modplayer->pattern_idx;
+	event.line = modplayer->line_idx;
+	event.tick = tick;
+	modplayer->event_callback(modplayer->event_user_data, &event);
+}
+
+static void save_checkpoint(mp_mod_player* modplayer, mp_checkpoint* checkpoint)
+{
+	checkpoint->position_frames = modplayer->position_frames;
+	checkpoint->pattern_idx = modplayer->pattern_idx;
+	checkpoint->line_idx = modplayer->line_idx;
+	checkpoint->tick_idx = modplayer->tick_idx;
+	checkpoint->frames_until_next_tick = modplayer->frames_until_next_tick;
+	checkpoint->speed = modplayer->speed;
+	checkpoint->bpm = modplayer->bpm;
+	checkpoint->do_position_jump = modplayer->do_position_jump;
+	checkpoint->position_jump_is_loop = modplayer->position_jump_is_loop;
+	checkpoint->position_jump_pat_idx = modplayer->position_jump_pat_idx;
+	checkpoint->position_jump_line_idx = modplayer->position_jump_line_idx;
+	checkpoint->pattern_delay = modplayer->pattern_delay;
+	checkpoint->line_channel_mask = modplayer->line_channel_mask;
+	checkpoint->on_song_timeline = modplayer->on_song_timeline;
+	checkpoint->event_pending = modplayer->event_pending;
+	checkpoint->pending_events = modplayer->pending_events;
+	memcpy(checkpoint->channel_state, modplayer->channel_state, sizeof(mp_channel_state) * modplayer->mod->num_channels);
+}
+
+static void restore_checkpoint(mp_mod_player* modplayer, const mp_checkpoint* checkpoint)
+{
+	modplayer->position_frames = checkpoint->position_frames;
+	modplayer->pattern_idx = checkpoint->pattern_idx;
+	modplayer->line_idx = checkpoint->line_idx;
+	modplayer->tick_idx = checkpoint->tick_idx;
+	modplayer->frames_until_next_tick = checkpoint->frames_until_next_tick;
+	modplayer->speed = checkpoint->speed;
+	modplayer->bpm = checkpoint->bpm;
+	modplayer->do_position_jump = checkpoint->do_position_jump;
+	modplayer->position_jump_is_loop = checkpoint->position_jump_is_loop;
+	modplayer->position_jump_pat_idx = checkpoint->position_jump_pat_idx;
+	modplayer->position_jump_line_idx = checkpoint->position_jump_line_idx;
+	modplayer->pattern_delay = checkpoint->pattern_delay;
+	modplayer->line_channel_mask = checkpoint->line_channel_mask;
+	modplayer->on_song_timeline = checkpoint->on_song_timeline;
+	modplayer->event_pending = checkpoint->event_pending;
+	modplayer->pending_events = checkpoint->pending_events;
+	memcpy(modplayer->channel_state, checkpoint->channel_state, sizeof(mp_channel_state) * modplayer->mod->num_channels);
+	// the output settings may have changed since the checkpoint was taken
+	update_channel_gains(modplayer);
+}
+
+#define MP_CACHE_BUCKETS 256
+
+// what a line's mix depends on, besides the channel states, which follow it in a cache key. a line
+// only ever starts on its first tick with the whole tick to go, so those aren't needed
+typedef struct mp_cache_key
+{
+	int pattern_idx;
+	int line_idx;
+	int speed;
+	int bpm;
+	int pattern_delay;
+	int do_position_jump;
+	int position_jump_is_loop;
+	int position_jump_pat_idx;
+	int position_jump_line_idx;
+	unsigned int line_channel_mask;
+	unsigned int output_sample_rate;
+	unsigned int output_channel_count;
+	float stereo_width;
+	int interpolation;
+	unsigned int muted_mask;
+} mp_cache_key;
+
+// a line in the render cache. it's followed in the pool by the channel states for end, then its key,
+// then its frames
+typedef struct mp_cache_entry
+{
+	struct mp_cache_entry* next; // the next entry in the same bucket
+	struct mp_cache_entry* newer; // the entry added after this one
+	unsigned long long hash;
+	unsigned int size; // the bytes the entry takes up in the pool
+	unsigned int num_frames;
+	mp_checkpoint end; // the player at the end of the line, which is the start of the next one
+} mp_cache_entry;
+
+struct mp_render_cache
+{
+	unsigned char* pool; // the entries, oldest to newest, wrapping round at the end. allocated along with the cache
+	unsigned int pool_size;
+	unsigned int head; // where the next entry goes
+	unsigned int states_size; // the channel states of the mod
+	unsigned int key_size;
+	unsigned char* key; // the key of the line starting now
+	mp_cache_entry* buckets[MP_CACHE_BUCKETS];
+	mp_cache_entry* oldest;
+	mp_cache_entry* newest;
+
+	mp_cache_entry* playing; // the line being copied out of the cache, if any
+	mp_cache_entry* recording; // the line being mixed into the cache, if any. it's added once it's finished
+	unsigned int line_frame; // how far into the playing or recording line the player is
+
+	mp_render_cache_stats stats;
+};
+
+// FNV-1a
+static unsigned long long hash_bytes(const unsigned char* data, unsigned int size)
+{
+	unsigned long long hash = 14695981039346656037ull;
+	for(unsigned int i=0; i<size; ++i)
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	return hash;
+}
+
+static void write_cache_key(const mp_mod_player* modplayer, unsigned char* key)
+{
+	mp_cache_key fields;
+	memset(&fields, 0x00, sizeof(fields));
+	fields.pattern_idx = modplayer->pattern_idx;
+	fields.line_idx = modplayer->line_idx;
+	fields.speed = modplayer->speed;
+	fields.bpm = modplayer->bpm;
+	fields.pattern_delay = modplayer->pattern_delay;
+	fields.do_position_jump = modplayer->do_position_jump;
+	if(modplayer->do_position_jump)
+	{
+		// the jump fields keep their values after the jump is done, which would split otherwise identical lines
+		fields.position_jump_is_loop = modplayer->position_jump_is_loop;
+		fields.position_jump_pat_idx = modplayer->position_jump_pat_idx;
+		fields.position_jump_line_idx = modplayer->position_jump_line_idx;
+	}
+	fields.line_channel_mask = modplayer->line_channel_mask;
+	fields.output_sample_rate = modplayer->output_sample_rate;
+	fields.output_channel_count = modplayer->output_channel_count;
+	fields.stereo_width = modplayer->stereo_width;
+	fields.interpolation = modplayer->interpolation;
+	fields.muted_mask = modplayer->muted_mask;
+
+	// the channel states are always copied whole (padding included) or cleared, so they compare byte for byte
+	memcpy(key, &fields, sizeof(fields));
+	memcpy(key + sizeof(fields), modplayer->channel_state, sizeof(mp_channel_state) * modplayer->mod->num_channels);
+}
+
+static mp_channel_state* cache_entry_states(mp_cache_entry* entry)
+{
+	return (mp_channel_state*)((unsigned char*)entry + MP_BLOCK_ALIGN(sizeof(mp_cache_entry)));
+}
+
+static unsigned char* cache_entry_key(const mp_render_cache* cache, mp_cache_entry* entry)
+{
+	return (unsigned char*)cache_entry_states(entry) + MP_BLOCK_ALIGN(cache->states_size);
+}
+
+static float* cache_entry_frames(const mp_render_cache* cache, mp_cache_entry* entry)
+{
+	return (float*)(cache_entry_key(cache, entry) + MP_BLOCK_ALIGN(cache->key_size));
+}
+
+static void evict_oldest(mp_render_cache* cache)
+{
+	mp_cache_entry* entry = cache->oldest;
+	mp_cache_entry** link = &cache->buckets[entry->hash % MP_CACHE_BUCKETS];
+	while(*link != entry)
+		link = &(*link)->next;
+	*link = entry->next;
+
+	cache->oldest = entry->newer;
+	if(cache->oldest == NULL)
+		cache->newest = NULL;
+	cache->stats.num_lines--;
+	cache->stats.bytes_used -= entry->size;
+	cache->stats.evictions++;
+}
+
+// find room for size bytes at the head of the pool, dropping the oldest entries until there is. size
+// has to fit in the pool. returns the offset of the room
+static unsigned int make_cache_room(mp_render_cache* cache, unsigned int size)
+{
+	for(;;)
+	{
+		if(cache->oldest == NULL)
+		{
+			cache->head = 0;
+			return 0;
+		}
+
+		// the free space runs from the head to the oldest entry, wrapping round at the end of the pool
+		unsigned int oldest = (unsigned int)((unsigned char*)cache->oldest - cache->pool);
+		if(oldest >= cache->head)
+		{
+			if(oldest - cache->head >= size)
+				return cache->head;
+		}
+		else if(cache->pool_size - cache->head >= size)
+		{
+			return cache->head;
+		}
+		else if(oldest >= size)
+		{
+			cache->head = 0;
+			return 0;
+		}
+
+		evict_oldest(cache);
+	}
+}
+
+// the player is at the start of a line: start copying it out of the cache if it's there,
+// otherwise start keeping it as it's mixed
+static void start_cached_line(mp_mod_player* modplayer)
+{
+	mp_render_cache* cache = modplayer->render_cache;
+	write_cache_key(modplayer, cache->key);
+	unsigned long long hash = hash_bytes(cache->key, cache->key_size);
+
+	for(mp_cache_entry* entry = cache->buckets[hash % MP_CACHE_BUCKETS]; entry != NULL; entry = entry->next)
+	{
+		if(entry->hash == hash && memcmp(cache_entry_key(cache, entry), cache->key, cache->key_size) == 0)
+		{
+			cache->playing = entry;
+			cache->line_frame = 0;
+			cache->stats.hits++;
+			return;
+		}
+	}
+
+	cache->stats.misses++;
+
+	// bpm and speed are only changed by the line itself, so every tick of it is the same length
+	unsigned long long num_frames = (unsigned long long)frames_per_tick(modplayer) * (modplayer->speed + modplayer->pattern_delay);
+	unsigned long long size = MP_BLOCK_ALIGN(sizeof(mp_cache_entry)) + MP_BLOCK_ALIGN(cache->states_size) + MP_BLOCK_ALIGN(cache->key_size) +
+		MP_BLOCK_ALIGN(num_frames * modplayer->output_channel_count * sizeof(float));
+	if(num_frames == 0 || size > cache->pool_size)
+		return;
+
+	unsigned int offset = make_cache_room(cache, (unsigned int)size);
+	mp_cache_entry* entry = (mp_cache_entry*)(cache->pool + offset);
+	entry->next = NULL;
+	entry->newer = NULL;
+	entry->hash = hash;
+	entry->size = (unsigned int)size;
+	entry->num_frames = (unsigned int)num_frames;
+	entry->end.channel_state = cache_entry_states(entry);
+	memcpy(cache_entry_key(cache, entry), cache->key, cache->key_size);
+
+	cache->recording = entry;
+	cache->line_frame = 0;
+}
+
+// the line being recorded has been played to the end: add it to the cache
+static void finish_cached_line(mp_mod_player* modplayer)
+{
+	mp_render_cache* cache = modplayer->render_cache;
+	mp_cache_entry* entry = cache->recording;
+	cache->recording = NULL;
+	save_checkpoint(modplayer, &entry->end);
+
+	mp_cache_entry** bucket = &cache->buckets[entry->hash % MP_CACHE_BUCKETS];
+	entry->next = *bucket;
+	*bucket = entry;
+	if(cache->newest != NULL)
+		cache->newest->newer = entry;
+	else
+		cache->oldest = entry;
+	cache->newest = entry;
+
+	cache->head = (unsigned int)((unsigned char*)entry - cache->pool) + entry->size;
+	cache->stats.num_lines++;
+	cache->stats.bytes_used += entry->size;
+}
+
+// copy the next of the frames of the line playing out of the cache, to frame frames into the buffer of
+// the decode call. once they've all been copied the player jumps to the end of the line, with the event for
+// the start of the next one still to send. returns the number of frames copied
+static unsigned int copy_cached_frames(mp_mod_player* modplayer, unsigned int frame_count, float* buffer_f, short* buffer, unsigned int frame)
+{
+	mp_render_cache* cache = modplayer->render_cache;
+	mp_cache_entry* entry = cache->playing;
+	unsigned int out_channels = modplayer->output_channel_count;
+	unsigned int num_frames = mp_min(frame_count, entry->num_frames - cache->line_frame);
+
+	// the line's own ticks are never run, but they're all frames_per_tick() long, so the events for the ones
+	// starting in these frames can still be sent. the player stays on the line until it's all been copied
+	if(modplayer->event_callback != NULL)
+	{
+		unsigned int tick_frames = (unsigned int)frames_per_tick(modplayer);
+		unsigned int tick_frame = (cache->line_frame / tick_frames + 1) * tick_frames;
+		for(; tick_frame <= cache->line_frame + num_frames && tick_frame < entry->num_frames; tick_frame += tick_frames)
+			send_event(modplayer, 0, frame + tick_frame - cache->line_frame, modplayer->position_frames + tick_frame, tick_frame / tick_frames);
+	}
+
+	float* frames = cache_entry_frames(cache, entry) + cache->line_frame * out_channels;
+	if(buffer_f != NULL)
+		memcpy(buffer_f, frames, num_frames * out_channels * sizeof(float));
+	if(buffer != NULL)
+		convert_to_int16(frames, num_frames * out_channels, buffer);
+	cache->line_frame += num_frames;
+	cache->stats.frames_copied += num_frames;
+
+	if(cache->line_frame == entry->num_frames)
+	{
+		unsigned long long position_frames = modplayer->position_frames + entry->num_frames;
+		restore_checkpoint(modplayer, &entry->end);
+		modplayer->position_frames = position_frames;
+		cache->playing = NULL;
+	}
+	return num_frames;
+}
+
+// while a line is copied out of the cache the player stays where the line started, so before anything
+// but decode_frames() uses the player, move it on to where it should be. a line being recorded is dropped
+static void leave_render_cache(mp_mod_player* modplayer)
+{
+	mp_render_cache* cache = modplayer->render_cache;
+	if(cache == NULL)
+		return;
+
+	cache->recording = NULL;
+	if(cache->playing != NULL)
+	{
+		// copy_cached_frames() has already sent the events for the ticks this steps over
+		cache->playing = NULL;
+		play_frames(modplayer, cache->line_frame, NULL, NULL);
+		modplayer->event_pending = false;
+	}
+}
+
+static void free_render_cache(mp_mod_player* modplayer)
+{
+	MP_FREE(modplayer->render_cache);
+	modplayer->render_cache = NULL;
+}
+
+// start the history of a song song_length orders long on the given line
+static void start_line_history(mp_line_history* history, int song_length, int order, int line)
+{
+	memset(history->visited, 0x00, sizeof(history->visited));
+	history->visited[order] = 1ull << (line & 63);
+	// pattern loops can repeat a line at most 16 times, unless they get tangled up with each other
+	// and never finish. give up after that many lines, so songs like that still come to an end
+	history->lines_left = song_length * 64 * 16;
+}
+
+// note down the line the sequencer has just moved to (events is what next_line() returned).
+// returns false if the song has come back round to a line it has already played
+static bool add_line_to_history(mp_line_history* history, int order, int line, int events)
+{
+	if(--history->lines_left <= 0)
+		return false;
+
+	line &= 63;
+	if(events & SeqEvent_PatternLoop)
+		history->visited[order] &= ~(~0ull << line); // a pattern loop plays the same lines again on purpose
+	else if(history->visited[order] & (1ull << line))
+		return false;
+
+	history->visited[order] |= 1ull << line;
+	return true;
+}
+
+static void free_seek_index(mp_mod_player* modplayer)
+{
+	if(modplayer->seek_index == NULL)
+		return;
+
+	MP_FREE(modplayer->seek_index);
+	modplayer->seek_index = NULL;
+}
+
+////////////// Public Interface ////////////////
+
+#if !defined(MOD_PLAYER_NO_MMAP)
+// map a whole file into memory, read only. returns NULL if the file can't be mapped
+static unsigned char* map_file(char* filename, size_t* size)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	void* data = NULL;
+	LARGE_INTEGER file_size;
+	if(GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+	{
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(mapping != NULL)
+		{
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping); // the view keeps the mapping alive
+		}
+		*size = (size_t)file_size.QuadPart;
+	}
+	CloseHandle(file);
+	return (unsigned char*)data;
+#else
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+
+	void* data = NULL;
+	struct stat st;
+	if(fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED)
+			data = NULL;
+		*size = (size_t)st.st_size;
+	}
+	close(fd); // the mapping stays valid after the file is closed
+	return (unsigned char*)data;
+#endif
+}
+
+static void unmap_file(unsigned char* data, size_t size)
+{
+#if defined(_WIN32)
+	(void)size;
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+}
+#endif // !MOD_PLAYER_NO_MMAP
+
+// what a mod file holds and where, worked out from its first MP_MOD_HEADER_SIZE bytes
+typedef struct mp_mod_layout
+{
+	mp_sample samples[32];
+	unsigned char pattern_table[128];
+	int song_length;
+	int num_patterns;
+	int num_channels;
+	bool flt8;
+	unsigned int patterns_size; // the pattern data, which follows the header
+	unsigned int sample_data_size; // the sample data, which follows the patterns
+} mp_mod_layout;
+
+// the song name, sample definitions, song length, pattern table and signature
+#define MP_MOD_HEADER_SIZE 1084
+
+// read the layout of a mod from its header. returns false if it isn't a mod we can play
+static bool read_mod_layout(const unsigned char* buf, mp_mod_layout* layout)
+{
+	memset(layout->samples, 0x00, sizeof(layout->samples));
+	layout->sample_data_size = 0;
+	const unsigned char* sample_def_data = &buf[20];
+	// samples are numbered from 1. sample 0 is always blank
+	for(int i=1; i<32; ++i)
+	{
+		read_sample(&layout->samples[i], (unsigned char*)sample_def_data);
+		sample_def_data += 30;
+		layout->sample_data_size += layout->samples[i].length;
+	}
+
+	const unsigned char* song_data = sample_def_data;
+	layout->song_length = mp_min(song_data[0], 128);
+	if(layout->song_length == 0)
+	{
+		fprintf(stderr, "Error reading mod, its song is empty\n");
+		return false;
+	}
+
+	layout->num_channels = read_channel_count(&song_data[130], &layout->flt8);
+	if(layout->num_channels == 0)
+	{
+		fprintf(stderr, "Error reading mod, it has more channels than we can play\n");
+		return false;
+	}
+
+	// FLT8 counts its patterns in halves, so the pattern table only has even numbers in it
+	for(int i=0; i<128; ++i)
+		layout->pattern_table[i] = layout->flt8 ? song_data[2 + i] / 2 : song_data[2 + i];
+
+	layout->num_patterns = 0;
+	for(int i=0; i<layout->song_length; ++i)
+	{
+		int patternIdx = layout->pattern_table[i] + 1;
+		layout->num_patterns = mp_max(patternIdx, layout->num_patterns);
+	}
+
+	layout->patterns_size = 256 * layout->num_channels * layout->num_patterns;
+	return true;
+}
+
+// create a mod from its header and patterns (the first MP_MOD_HEADER_SIZE + patterns_size bytes of buf).
+// if borrow_samples is true the sample data is used in place, so buf has to hold the whole file and outlive
+// the mod. otherwise each sample gets room of its own, to be filled in by copy_sample_data()
+static mp_mod* create_mod(unsigned char* buf, const mp_mod_layout* layout, bool borrow_samples)
+{
+	int num_samples = 32;
+	int num_patterns = layout->num_patterns;
+	int num_channels = layout->num_channels;
+	unsigned char* pattern_data = &buf[MP_MOD_HEADER_SIZE];
+	unsigned char scratch[2048];
+	int num_notes = 0;
+	for(int i=0; i<num_patterns; ++i)
+		num_notes += count_pattern_notes(pattern_lines(pattern_data, i, num_channels, layout->flt8, scratch), num_channels);
+
+	// the mod, its name, samples, patterns and (unless they're borrowed) the sample data, all in one block
+	size_t name_offset = MP_BLOCK_ALIGN(sizeof(mp_mod));
+	size_t samples_offset = name_offset + MP_BLOCK_ALIGN(21);
+	size_t patterns_offset = samples_offset + MP_BLOCK_ALIGN(num_samples * sizeof(mp_sample));
+	size_t notes_offset = patterns_offset + MP_BLOCK_ALIGN(num_patterns * sizeof(mp_pattern));
+	size_t sample_data_offset = notes_offset + MP_BLOCK_ALIGN(num_notes * sizeof(mp_channel_note));
+	size_t block_size = sample_data_offset;
+	if(!borrow_samples)
+		block_size += (num_samples * (MP_SAMPLE_PADDING + MP_SAMPLE_GUARD) + layout->sample_data_size) * sizeof(mp_sample_t);
+
+	unsigned char* block = (unsigned char*)MP_MALLOC(block_size);
+	if(block == NULL)
+	{
+		fprintf(stderr, "Error reading mod, out of memory\n");
+		return NULL;
+	}
+
+	mp_mod* mod = (mp_mod*)block;
+	memset(mod, 0x00, sizeof(mp_mod));
+	mod->name = (char*)(block + name_offset);
+	mod->samples = (mp_sample*)(block + samples_offset);
+	mod->patterns = (mp_pattern*)(block + patterns_offset);
+
+	memcpy(mod->name, buf, 20);
+	mod->name[20] = '\0';
+
+	mod->num_channels = num_channels;
+
+	mod->num_samples = num_samples;
+	memcpy(mod->samples, layout->samples, sizeof(layout->samples));
+
+	mod->song_length = layout->song_length;
+	memcpy(mod->pattern_table, layout->pattern_table, 128);
+	mod->num_patterns = num_patterns;
+
+	// read patterns
+	mp_channel_note* notes = (mp_channel_note*)(block + notes_offset);
+	for(int i=0; i<num_patterns; ++i)
+	{
+		read_pattern(&mod->patterns[i], notes, pattern_lines(pattern_data, i, num_channels, layout->flt8, scratch), num_channels, num_samples);
+		notes += mod->patterns[i].line_start[64];
+	}
+
+	mod->owns_sample_data = !borrow_samples;
+
+	// the sample data always follows at least the 1084 byte header, so there is
+	// room in front of even the first borrowed sample for the MP_SAMPLE_PADDING reads
+	signed char* sample_data = (signed char*)&pattern_data[layout->patterns_size];
+	mp_sample_t* owned_data = (mp_sample_t*)(block + sample_data_offset);
+	for(int i=0; i<num_samples; ++i)
+	{
+		mp_sample* sample = &mod->samples[i];
+		if(sample->length > 0 && borrow_samples)
+		{
+			sample->sample_data = (mp_sample_t*)sample_data;
+		}
+		else if(sample->length > 0)
+		{
+			memset(owned_data, 0x00, MP_SAMPLE_PADDING * sizeof(mp_sample_t));
+			sample->sample_data = owned_data + MP_SAMPLE_PADDING;
+			owned_data += MP_SAMPLE_PADDING + sample->length + MP_SAMPLE_GUARD;
+			sample->guarded = 1;
+		}
+		else
+		{
+			sample->sample_data = NULL;
+		}
+
+		sample_data += sample->length;
+	}
+
+	return mod;
+}
+
+// copy num_frames of a sample's data from the mod file into its own storage, starting at frame first
+static void copy_sample_data(mp_sample* sample, const signed char* data, int first, int num_frames)
+{
+#ifdef MOD_PLAYER_FLOAT_SAMPLES
+	for(int f=0; f<num_frames; ++f)
+		sample->sample_data[first + f] = (1.0f / 128.0f) * data[f];
+#else
+	memcpy(&sample->sample_data[first], data, num_frames);
+#endif
+}
+
+// fill in the guard after a copied sample, once all of it is there. the guard carries on where
+// playback goes after the last sample
+static void fill_sample_guard(mp_sample* sample)
+{
+	for(int g=0; g<MP_SAMPLE_GUARD; ++g)
+	{
+		mp_sample_t* guard = &sample->sample_data[sample->length + g];
+		*guard = sample->loop > 0 ? sample->sample_data[sample->repeat_offset + g % sample->repeat_length] : 0;
+	}
+}
+
+// parse a mod file. if borrow_samples is true, the 8 bit sample data is used in place rather
+// than copied, so buf has to outlive the mod. (float samples are always converted into a copy)
+static mp_mod* load_mod(unsigned char* buf, unsigned int buflen, bool borrow_samples)
+{
+	if(buflen < 2048)
+	{
+		fprintf(stderr, "This doesn't look like a mod file: too short\n");
+		return NULL;
+	}
+
+	// read the sample definitions first, so the whole mod can go in one allocation once its size is known
+	mp_mod_layout layout;
+	if(!read_mod_layout(buf, &layout))
+		return NULL;
+
+	unsigned int expected_file_size = MP_MOD_HEADER_SIZE + layout.patterns_size + layout.sample_data_size;
+	if(buflen < expected_file_size)
+	{
+		fprintf(stderr, "Error reading mod, file may be corrupted or not a protracker mod\n");
+		return NULL;
+	}
+
+#ifdef MOD_PLAYER_FLOAT_SAMPLES
+	borrow_samples = false;
+#endif
+
+	mp_mod* mod = create_mod(buf, &layout, borrow_samples);
+	if(mod == NULL || borrow_samples)
+		return mod;
+
+	signed char* sample_data = (signed char*)&buf[MP_MOD_HEADER_SIZE + layout.patterns_size];
+	for(int i=0; i<mod->num_samples; ++i)
+	{
+		mp_sample* sample = &mod->samples[i];
+		if(sample->length > 0)
+		{
+			copy_sample_data(sample, sample_data, 0, sample->length);
+			fill_sample_guard(sample);
+		}
+		sample_data += sample->length;
+	}
+
+	return mod;
+}
+
+static mp_mod_player* create_player_with_own_mod(mp_mod* mod)
+{
+	if(mod == NULL)
+		return NULL;
+
+	mp_mod_player* modplayer = modplayer_create_player(mod);
+	if(modplayer == NULL)
+	{
+		modplayer_mod_free(mod);
+		return NULL;
+	}
+
+	modplayer->owns_mod = true;
+	return modplayer;
+}
+
+mp_mod* modplayer_mod_create_from_file(char* filename)
+{
+	FILE* fp = fopen(filename, "rb");
+
+	if(fp == NULL)
+	{
+		fprintf(stderr, "Error opening mod file %s\n", filename);
+		return NULL;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size_t len = ftell(fp);
+	rewind(fp);
+
+	unsigned char* buf = (unsigned char*)MP_MALLOC(len);
+	size_t read = buf != NULL ? fread(buf, len, 1, fp) : 0;
+	fclose(fp);
+
+	if(read != 1)
+	{
+		fprintf(stderr, "Error reading mod file %s\n", filename);
+		MP_FREE(buf);
+		return NULL;
+	}
+
+	// the samples are played straight out of the file buffer, so the mod keeps hold of it
+	mp_mod* mod = load_mod(buf, (unsigned int)len, true);
+	if(mod == NULL || mod->owns_sample_data)
+		MP_FREE(buf);
+	else
+		mod->file_data = buf;
+	return mod;
+}
+
+mp_mod* modplayer_mod_create_from_file_mapped(char* filename)
+{
+#if defined(MOD_PLAYER_NO_MMAP)
+	return modplayer_mod_create_from_file(filename);
+#else
+	size_t len = 0;
+	unsigned char* data = map_file(filename, &len);
+
+	if(data == NULL)
+	{
+		fprintf(stderr, "Error mapping mod file %s\n", filename);
+		return NULL;
+	}
+
+	mp_mod* mod = load_mod(data, (unsigned int)len, true);
+	if(mod == NULL || mod->owns_sample_data)
+	{
+		unmap_file(data, len);
+	}
+	else
+	{
+		mod->mapped_data = data;
+		mod->mapped_size = len;
+	}
+	return mod;
+#endif
+}
+
+mp_mod* modplayer_mod_create_from_buffer(unsigned char* buf, unsigned int buflen)
+{
+	return load_mod(buf, buflen, false);
+}
+
+mp_mod* modplayer_mod_create_from_buffer_borrowed(unsigned char* buf, unsigned int buflen)
+{
+	return load_mod(buf, buflen, true);
+}
+
+// the sequencer cut down to what decides how long each line lasts and which line comes next, run straight over
+// the pattern bytes of a mod file, so modplayer_probe_buffer() can time a song without creating a mod or a player.
+// it follows the same rules as next_line() and execute_effect() do for Bxx, Dxy, E6x, EEx and Fxx
+typedef struct mp_probe_sequencer
+{
+	const mp_mod_layout* layout;
+	unsigned char* pattern_data;
+	unsigned char* lines; // the pattern of the current order, see pattern_lines()
+	int pattern_idx;
+	int line_idx;
+	int speed;
+	int bpm;
+	int pattern_delay;
+	bool do_position_jump;
+	bool position_jump_is_loop;
+	int position_jump_pat_idx;
+	int position_jump_line_idx;
+	int loop_start[MP_MAX_CHANNELS];
+	int loop_count[MP_MAX_CHANNELS];
+	unsigned char scratch[2048];
+} mp_probe_sequencer;
+
+static void probe_start_order(mp_probe_sequencer* sequencer)
+{
+	const mp_mod_layout* layout = sequencer->layout;
+	sequencer->lines = pattern_lines(sequencer->pattern_data, layout->pattern_table[sequencer->pattern_idx], layout->num_channels, layout->flt8, sequencer->scratch);
+	memset(sequencer->loop_start, 0x00, sizeof(sequencer->loop_start));
+	memset(sequencer->loop_count, 0x00, sizeof(sequencer->loop_count));
+}
+
+// run the timing effects of the current line, a channel at a time as execute_line() does
+static void probe_execute_line(mp_probe_sequencer* sequencer)
+{
+	int num_channels = sequencer->layout->num_channels;
+	const unsigned char* cell = &sequencer->lines[4 * num_channels * sequencer->line_idx];
+	for(int c=0; c<num_channels; ++c, cell += 4)
+	{
+		unsigned char effect_val = cell[3];
+		unsigned char effect_x = upper_nibble(effect_val);
+		unsigned char effect_y = lower_nibble(effect_val);
+		switch(cell[2] & 0x0f)
+		{
+			case Effect_PositionJump:
+				if(!sequencer->do_position_jump)
+					sequencer->position_jump_line_idx = 0;
+				sequencer->position_jump_pat_idx = effect_val;
+				sequencer->do_position_jump = true;
+				sequencer->position_jump_is_loop = false;
+				break;
+			case Effect_PatternBreak:
+				if(!sequencer->do_position_jump)
+					sequencer->position_jump_pat_idx = sequencer->pattern_idx + 1;
+				sequencer->position_jump_line_idx = pattern_break_line(effect_x, effect_y);
+				sequencer->do_position_jump = true;
+				sequencer->position_jump_is_loop = false;
+				break;
+			case Effect_Extended:
+				if(effect_x == ExtEffect_SetJumpLoop && effect_y == 0)
+				{
+					sequencer->loop_start[c] = sequencer->line_idx;
+				}
+				else if(effect_x == ExtEffect_SetJumpLoop)
+				{
+					if(sequencer->loop_count[c] == 0)
+						sequencer->loop_count[c] = effect_y;
+					else
+						sequencer->loop_count[c]--;
+
+					if(sequencer->loop_count[c] > 0)
+					{
+						sequencer->position_jump_line_idx = sequencer->loop_start[c];
+						sequencer->position_jump_pat_idx = sequencer->pattern_idx;
+						sequencer->do_position_jump = true;
+						sequencer->position_jump_is_loop = true;
+					}
+				}
+				else if(effect_x == ExtEffect_PatternDelay)
+				{
+					sequencer->pattern_delay = effect_y * sequencer->speed;
+				}
+				break;
+			case Effect_SetSpeed:
+				if(effect_val <= 32)
+					sequencer->speed = mp_max(1, effect_val);
+				else
+					sequencer->bpm = effect_val;
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+// next_line() for the probe. returns a mask of SequencerEvent values
+static int probe_next_line(mp_probe_sequencer* sequencer)
+{
+	int events = SeqEvent_NewLine;
+	sequencer->pattern_delay = 0;
+	sequencer->line_idx++;
+
+	if(sequencer->do_position_jump || sequencer->line_idx >= 64)
+	{
+		int old_pattern_idx = sequencer->pattern_idx;
+		if(sequencer->do_position_jump)
+		{
+			sequencer->line_idx = sequencer->position_jump_line_idx;
+			sequencer->pattern_idx = sequencer->position_jump_pat_idx;
+			sequencer->do_position_jump = false;
+			if(sequencer->position_jump_is_loop)
+				events |= SeqEvent_PatternLoop;
+			sequencer->position_jump_is_loop = false;
+		}
+		else
+		{
+			sequencer->line_idx = 0;
+			sequencer->pattern_idx++;
+		}
+
+		if(sequencer->pattern_idx >= sequencer->layout->song_length)
+		{
+			sequencer->pattern_idx = 0;
+			events |= SeqEvent_SongLoop;
+		}
+
+		if(sequencer->pattern_idx != old_pattern_idx)
+		{
+			events |= SeqEvent_NewOrder;
+			probe_start_order(sequencer);
+		}
+	}
+
+	probe_execute_line(sequencer);
+	return events;
+}
+
+// run_sequencer() for the probe: play the song from the start until it gets to a line it has already
+// played or to the given line, and return the number of frames that took at sample_rate
+static unsigned long long probe_run_sequencer(mp_probe_sequencer* sequencer, unsigned int sample_rate, int stop_order, int stop_line)
+{
+	sequencer->pattern_idx = 0;
+	sequencer->line_idx = 0;
+	sequencer->speed = 6;
+	sequencer->bpm = 125;
+	sequencer->pattern_delay = 0;
+	sequencer->do_position_jump = false;
+	sequencer->position_jump_is_loop = false;
+	probe_start_order(sequencer);
+	probe_execute_line(sequencer);
+
+	mp_line_history history;
+	start_line_history(&history, sequencer->layout->song_length, 0, 0);
+
+	unsigned long long frames = 0;
+	while(sequencer->pattern_idx != stop_order || sequencer->line_idx != stop_line)
+	{
+		frames += (unsigned long long)(sequencer->speed + sequencer->pattern_delay) * tick_length(sample_rate, sequencer->bpm);
+
+		int events = probe_next_line(sequencer);
+		if(!add_line_to_history(&history, sequencer->pattern_idx, sequencer->line_idx, events))
+			break;
+	}
+	return frames;
+}
+
+bool modplayer_probe_buffer(const unsigned char* buf, unsigned int buflen, bool measure_duration, mp_mod_info* info)
+{
+	memset(info, 0x00, sizeof(mp_mod_info));
+	if(buflen < MP_MOD_HEADER_SIZE)
+	{
+		fprintf(stderr, "This doesn't look like a mod file: too short\n");
+		return false;
+	}
+
+	mp_mod_layout layout;
+	if(!read_mod_layout(buf, &layout))
+		return false;
+
+	memcpy(info->name, buf, 20);
+	info->num_channels = layout.num_channels;
+	info->song_length = layout.song_length;
+	info->num_patterns = layout.num_patterns;
+	for(int i=0; i<31; ++i)
+	{
+		const mp_sample* sample = &layout.samples[i + 1];
+		mp_sample_info* sample_info = &info->samples[i];
+		memcpy(sample_info->name, sample->name, 23);
+		sample_info->length = sample->length;
+		sample_info->volume = sample->volume;
+		sample_info->fine_tune = sample->fine_tune;
+		sample_info->loop_start = sample->repeat_offset;
+		sample_info->loop_length = sample->loop > 0 ? sample->repeat_length : 0;
+	}
+	info->file_size = MP_MOD_HEADER_SIZE + layout.patterns_size + layout.sample_data_size;
+
+	if(!measure_duration)
+		return true;
+
+	if(buflen < MP_MOD_HEADER_SIZE + layout.patterns_size)
+	{
+		fprintf(stderr, "Error reading mod, file may be corrupted or not a protracker mod\n");
+		return false;
+	}
+
+	// timed as modplayer_measure_song() would for a new player, at its default sample rate
+	unsigned int sample_rate = 48000;
+	mp_probe_sequencer sequencer;
+	sequencer.layout = &layout;
+	sequencer.pattern_data = (unsigned char*)&buf[MP_MOD_HEADER_SIZE];
+
+	unsigned long long song_frames = probe_run_sequencer(&sequencer, sample_rate, -1, -1);
+	unsigned long long loop_frame = probe_run_sequencer(&sequencer, sample_rate, sequencer.pattern_idx, sequencer.line_idx);
+	info->duration = (double)song_frames / sample_rate;
+	info->loop_start = (double)loop_frame / sample_rate;
+	return true;
+}
+
+void modplayer_mod_free(mp_mod* mod)
+{
+	if(mod == NULL)
+		return;
+
+	// everything but the file the samples are borrowed from is in the same block as the mod, see load_mod()
+	MP_FREE(mod->file_data);
+#if !defined(MOD_PLAYER_NO_MMAP)
+	if(mod->mapped_data != NULL)
+		unmap_file(mod->mapped_data, mod->mapped_size);
+#endif
+	MP_FREE(mod);
+}
+
+struct mp_mod_loader
+{
+	mp_mod_layout layout;
+	unsigned char first_bytes[MP_MOD_HEADER_SIZE];
+	unsigned char* header; // where the bytes before the sample data go, until the mod is created from them
+	unsigned int header_size; // MP_MOD_HEADER_SIZE until the layout is known, then that plus the patterns
+	unsigned int received; // bytes of the file taken so far
+	mp_mod* mod;
+	int sample_idx; // the sample being filled in
+	unsigned int sample_offset; // where sample_idx starts in the sample data
+	unsigned int sample_ends[32]; // where each sample ends in the file
+	bool failed;
+};
+
+mp_mod_loader* modplayer_loader_create(void)
+{
+	mp_mod_loader* loader = (mp_mod_loader*)MP_MALLOC(sizeof(mp_mod_loader));
+	if(loader == NULL)
+	{
+		fprintf(stderr, "Error creating mod loader, out of memory\n");
+		return NULL;
+	}
+
+	memset(loader, 0x00, sizeof(mp_mod_loader));
+	loader->header = loader->first_bytes;
+	loader->header_size = MP_MOD_HEADER_SIZE;
+	return loader;
+}
+
+// the header (or the header and patterns) is in: work out the layout, or create the mod
+static bool finish_loader_header(mp_mod_loader* loader)
+{
+	if(loader->header == loader->first_bytes)
+	{
+		if(!read_mod_layout(loader->first_bytes, &loader->layout))
+			return false;
+
+		loader->header_size = MP_MOD_HEADER_SIZE + loader->layout.patterns_size;
+		loader->header = (unsigned char*)MP_MALLOC(loader->header_size);
+		if(loader->header == NULL)
+		{
+			fprintf(stderr, "Error reading mod, out of memory\n");
+			return false;
+		}
+		memcpy(loader->header, loader->first_bytes, MP_MOD_HEADER_SIZE);
+		return true;
+	}
+
+	loader->mod = create_mod(loader->header, &loader->layout, false);
+	MP_FREE(loader->header);
+	loader->header = NULL;
+	if(loader->mod == NULL)
+		return false;
+
+	// silence until the samples arrive
+	mp_mod* mod = loader->mod;
+	for(int i=0; i<mod->num_samples; ++i)
+	{
+		mp_sample* sample = &mod->samples[i];
+		if(sample->length > 0)
+			memset(sample->sample_data, 0x00, (sample->length + MP_SAMPLE_GUARD) * sizeof(mp_sample_t));
+	}
+
+	unsigned int sample_end = loader->header_size;
+	for(int i=0; i<mod->num_samples; ++i)
+	{
+		sample_end += mod->samples[i].length;
+		loader->sample_ends[i] = sample_end;
+	}
+	return true;
+}
+
+bool modplayer_loader_push(mp_mod_loader* loader, const unsigned char* data, unsigned int len)
+{
+	if(loader->failed)
+		return false;
+
+	while(loader->mod == NULL)
+	{
+		unsigned int num_bytes = mp_min(len, loader->header_size - loader->received);
+		memcpy(&loader->header[loader->received], data, num_bytes);
+		loader->received += num_bytes;
+		data += num_bytes;
+		len -= num_bytes;
+		if(loader->received < loader->header_size)
+			return true;
+
+		if(!finish_loader_header(loader))
+		{
+			loader->failed = true;
+			return false;
+		}
+	}
+
+	mp_mod* mod = loader->mod;
+	while(loader->sample_idx < mod->num_samples)
+	{
+		mp_sample* sample = &mod->samples[loader->sample_idx];
+		unsigned int filled = loader->received - loader->header_size - loader->sample_offset;
+		unsigned int num_frames = mp_min(len, (unsigned int)sample->length - filled);
+		if(num_frames > 0)
+			copy_sample_data(sample, (const signed char*)data, filled, num_frames);
+		loader->received += num_frames;
+		data += num_frames;
+		len -= num_frames;
+		if(filled + num_frames < (unsigned int)sample->length)
+			break;
+
+		if(sample->length > 0)
+			fill_sample_guard(sample);
+		loader->sample_offset += sample->length;
+		loader->sample_idx++;
+	}
+
+	// anything after the last sample is ignored
+	return true;
+}
+
+mp_mod* modplayer_loader_get_mod(mp_mod_loader* loader)
+{
+	return loader->mod;
+}
+
+bool modplayer_loader_is_ready(mp_mod_loader* loader, int num_lines)
+{
+	mp_mod* mod = loader->mod;
+	if(mod == NULL)
+		return false;
+
+	// the samples are stored one after another, so the lines are ready when the last of their samples has arrived
+	for(int line=0; line<num_lines && line < 64 * mod->song_length; ++line)
+	{
+		mp_pattern* pattern = &mod->patterns[mod->pattern_table[line / 64]];
+		mp_channel_note* line_end = &pattern->notes[pattern->line_start[line % 64 + 1]];
+		for(mp_channel_note* note = &pattern->notes[pattern->line_start[line % 64]]; note != line_end; ++note)
+		{
+			if(note->sample < mod->num_samples && loader->received < loader->sample_ends[note->sample])
+				return false;
+		}
+	}
+	return true;
+}
+
+bool modplayer_loader_is_complete(mp_mod_loader* loader)
+{
+	return loader->mod != NULL && loader->sample_idx == loader->mod->num_samples;
+}
+
+void modplayer_loader_free(mp_mod_loader* loader)
+{
+	if(loader == NULL)
+		return;
+
+	if(loader->header != loader->first_bytes)
+		MP_FREE(loader->header);
+	MP_FREE(loader);
+}
+
+mp_mod_player* modplayer_create_from_mod(mp_mod* mod)
+{
+	if(mod == NULL)
+		return NULL;
+
+	return modplayer_create_player(mod);
+}
+
+mp_mod_player* modplayer_create_from_file(char* filename)
+{
+	return create_player_with_own_mod(modplayer_mod_create_from_file(filename));
+}
+
+mp_mod_player* modplayer_create_from_file_mapped(char* filename)
+{
+	return create_player_with_own_mod(modplayer_mod_create_from_file_mapped(filename));
+}
+
+mp_mod_player* modplayer_create_from_buffer(unsigned char* buf, unsigned int buflen)
+{
+	return create_player_with_own_mod(modplayer_mod_create_from_buffer(buf, buflen));
+}
+
+mp_mod_player* modplayer_create_from_buffer_borrowed(unsigned char* buf, unsigned int buflen)
+{
+	return create_player_with_own_mod(modplayer_mod_create_from_buffer_borrowed(buf, buflen));
+}
+
+void modplayer_free(mp_mod_player* modplayer)
+{
+	if(modplayer == NULL)
+		return;
+
+	if(modplayer->owns_mod)
+		modplayer_mod_free(modplayer->mod);
+
+	free_seek_index(modplayer);
+	free_render_cache(modplayer);
+	MP_FREE(modplayer);
+}
+
+void modplayer_set_sample_rate(mp_mod_player* modplayer, unsigned int sample_rate)
+{
+	leave_render_cache(modplayer);
+
+	// the rest of the current tick was worked out at the old rate. a tick that hasn't started yet (as after
+	// creating the player) gets its full length at the new rate, the same as a reset or seek would give it.
+	// one that's under way is scaled to the new rate
+	if(modplayer->frames_until_next_tick == frames_per_tick(modplayer))
+	{
+		modplayer->frames_until_next_tick = tick_length(sample_rate, modplayer->bpm);
 	}
+	else
+	{
+		unsigned long long frames = (unsigned long long)modplayer->frames_until_next_tick * sample_rate;
+		modplayer->frames_until_next_tick = (int)(frames / modplayer->output_sample_rate);
+	}
+	modplayer->output_sample_rate = sample_rate;
+	modplayer->step_per_period = MP_AMIGA_CLOCK / (2.0f * sample_rate);
+}
+
+void modplayer_set_stereo(mp_mod_player* modplayer, bool is_stereo)
+{
+	leave_render_cache(modplayer);
+	modplayer->output_channel_count = is_stereo ? 2 : 1;
+	update_channel_gains(modplayer);
+}
+
+void modplayer_set_stereo_width(mp_mod_player* modplayer, float stereo_width)
+{
+	leave_render_cache(modplayer);
+	modplayer->stereo_width = stereo_width;
+	update_channel_gains(modplayer);
+}
+
+void modplayer_set_interpolation(mp_mod_player* modplayer, mp_interpolation interpolation)
+{
+	leave_render_cache(modplayer);
+	modplayer->interpolation = (unsigned int)interpolation <= MP_INTERPOLATION_SINC ? interpolation : MP_INTERPOLATION_LINEAR;
+}
+
+void modplayer_set_channel_muted(mp_mod_player* modplayer, int channel, bool muted)
+{
+	leave_render_cache(modplayer);
+	if(channel < 0 || channel >= modplayer->mod->num_channels)
+		return;
+
+	if(muted)
+		modplayer->muted_mask |= 1u << channel;
+	else
+		modplayer->muted_mask &= ~(1u << channel);
+}
+
+bool modplayer_set_render_cache(mp_mod_player* modplayer, unsigned int max_bytes)
+{
+	leave_render_cache(modplayer);
+	free_render_cache(modplayer);
+	if(max_bytes == 0)
+		return true;
+
+	// the cache, the key of the current line and the pool are one allocation
+	unsigned int states_size = sizeof(mp_channel_state) * modplayer->mod->num_channels;
+	unsigned int key_size = sizeof(mp_cache_key) + states_size;
+	size_t key_offset = MP_BLOCK_ALIGN(sizeof(mp_render_cache));
+	size_t pool_offset = key_offset + MP_BLOCK_ALIGN(key_size);
+	unsigned char* block = (unsigned char*)MP_MALLOC(pool_offset + max_bytes);
+	if(block == NULL)
+	{
+		fprintf(stderr, "Error creating render cache, out of memory\n");
+		return false;
+	}
+
+	mp_render_cache* cache = (mp_render_cache*)block;
+	memset(cache, 0x00, sizeof(mp_render_cache));
+	cache->pool = block + pool_offset;
+	cache->pool_size = max_bytes;
+	cache->states_size = states_size;
+	cache->key_size = key_size;
+	cache->key = block + key_offset;
+	modplayer->render_cache = cache;
+	return true;
+}
+
+void modplayer_get_render_cache_stats(mp_mod_player* modplayer, mp_render_cache_stats* stats)
+{
+	if(modplayer->render_cache != NULL)
+		*stats = modplayer->render_cache->stats;
+	else
+		memset(stats, 0x00, sizeof(mp_render_cache_stats));
+}
+
+void modplayer_set_event_callback(mp_mod_player* modplayer, mp_event_callback callback, void* user_data)
+{
+	modplayer->event_callback = callback;
+	modplayer->event_user_data = user_data;
+}
+
+#if defined(MOD_PLAYER_STATS)
+const mp_stats* modplayer_get_stats(mp_mod_player* modplayer)
+{
+	return &modplayer->stats;
+}
+
+void modplayer_reset_stats(mp_mod_player* modplayer)
+{
+	memset(&modplayer->stats, 0x00, sizeof(mp_stats));
+}
+
+void modplayer_set_timing_hook(mp_mod_player* modplayer, mp_timing_hook hook, void* user_data)
+{
+	modplayer->timing_hook = hook;
+	modplayer->timing_user_data = user_data;
+}
+#endif
+
+// put the player back to how it is at the start of the song, except that it starts at the given order
+static void reset_player(mp_mod_player* modplayer, int order)
+{
+	modplayer->pattern_idx = order;
+	modplayer->line_idx = 0;
+	modplayer->tick_idx = 0;
+	modplayer->frames_until_next_tick = 0;
+
+	modplayer->speed = 6;
+	modplayer->bpm = 125;
+
+	modplayer->do_position_jump = false;
+	modplayer->position_jump_is_loop = false;
+	modplayer->pattern_delay = 0;
+	modplayer->line_channel_mask = 0;
+	// only order 0 is where the song starts. anywhere else, position_frames counts from the jump
+	modplayer->position_frames = 0;
+	modplayer->on_song_timeline = order == 0;
+
+	for(int i=0; i<modplayer->mod->num_channels; ++i)
+	{
+		mp_channel_state* state = &modplayer->channel_state[i];
+		float panning = state->panning;
+		memset(state, 0x00, sizeof(mp_channel_state));
+		state->panning = panning;
+	}
+	update_channel_gains(modplayer);
+
+	execute_line(modplayer);
+	modplayer->event_pending = true;
+	modplayer->pending_events = SeqEvent_NewLine | SeqEvent_NewOrder;
+}
 
-	mod->num_patterns = num_patterns;
-			
-	char mk[5];
-	memcpy(mk, &song_data[130], 4);
-	mk[4] = '\0';
+void modplayer_reset_song_to_beginning(mp_mod_player* modplayer)
+{
+	leave_render_cache(modplayer);
+	reset_player(modplayer, 0);
+}
 
-	unsigned int expected_file_size = 1082 + 1024*num_patterns + sample_data_size;
-	if(buflen < expected_file_size)
+bool modplayer_build_seek_index(mp_mod_player* modplayer)
+{
+	leave_render_cache(modplayer);
+	int num_channels = modplayer->mod->num_channels;
+	free_seek_index(modplayer);
+
+	// one set of channel states per checkpoint, plus one to hold on to the current state, all in the same block as the index
+	size_t states_offset = MP_BLOCK_ALIGN(sizeof(mp_seek_index));
+	unsigned char* block = (unsigned char*)MP_MALLOC(states_offset + sizeof(mp_channel_state) * num_channels * 129);
+	if(block == NULL)
+		return false;
+
+	mp_seek_index* index = (mp_seek_index*)block;
+	mp_channel_state* channel_states = (mp_channel_state*)(block + states_offset);
+
+	index->sample_rate = modplayer->output_sample_rate;
+	index->num_checkpoints = 0;
+	for(int i=0; i<128; ++i)
+		index->checkpoints[i].channel_state = &channel_states[i * num_channels];
+
+	mp_checkpoint current;
+	current.channel_state = &channel_states[128 * num_channels];
+	save_checkpoint(modplayer, &current);
+
+	modplayer_reset_song_to_beginning(modplayer);
+	save_checkpoint(modplayer, &index->checkpoints[index->num_checkpoints++]);
+
+	mp_line_history history;
+	start_line_history(&history, modplayer->mod->song_length, modplayer->pattern_idx, modplayer->line_idx);
+	for(;;)
 	{
-		fprintf(stderr, "Error reading mod, file may be corrupted or not a protracker mod\n");
-		return NULL;
+		// run to the end of the current tick, without mixing
+		int events = play_frames(modplayer, modplayer->frames_until_next_tick, NULL, NULL);
+		if((events & SeqEvent_NewLine) == 0)
+			continue;
+		if(!add_line_to_history(&history, modplayer->pattern_idx, modplayer->line_idx, events))
+			break;
+
+		if((events & SeqEvent_NewOrder) && index->num_checkpoints < 128)
+			save_checkpoint(modplayer, &index->checkpoints[index->num_checkpoints++]);
 	}
 
-	unsigned char* pattern_data = &song_data[134];
+	restore_checkpoint(modplayer, &current);
+	modplayer->seek_index = index;
+	return true;
+}
 
-	// read patterns
-	mod->patterns = (mp_pattern*)malloc(sizeof(mp_pattern) * num_patterns);
-	for(int i=0; i<num_patterns; ++i)
+void modplayer_seek_seconds(mp_mod_player* modplayer, float seconds)
+{
+	leave_render_cache(modplayer);
+	unsigned long long target_frame = seconds > 0.0f ? (unsigned long long)((double)seconds * modplayer->output_sample_rate) : 0;
+
+	// the frame positions in the index are only right for the sample rate it was built at
+	if(modplayer->seek_index != NULL && modplayer->seek_index->sample_rate != modplayer->output_sample_rate)
+		modplayer_build_seek_index(modplayer);
+
+	// start from the latest checkpoint before the target (the song start if there is no index),
+	// unless the player is already between that and the target. after a straight jump to an order its
+	// position isn't a time in the song, so it always starts over
+	mp_seek_index* index = modplayer->seek_index;
+	const mp_checkpoint* checkpoint = NULL;
+	if(index != NULL)
 	{
-		read_pattern(&mod->patterns[i], &pattern_data[1024 * i]);
+		int i = index->num_checkpoints - 1;
+		while(i > 0 && index->checkpoints[i].position_frames > target_frame)
+			--i;
+		checkpoint = &index->checkpoints[i];
 	}
 
-	char* sample_data = (char*)&pattern_data[1024 * num_patterns];
-	for(int i=0; i<num_samples; ++i)
+	unsigned long long start_frame = checkpoint != NULL ? checkpoint->position_frames : 0;
+	if(!modplayer->on_song_timeline || modplayer->position_frames < start_frame || modplayer->position_frames > target_frame)
 	{
-		mp_sample* sample = &mod->samples[i];
-		if(sample->length > 0)
-		{
-			int num_frames = sample->length;
-			sample->sample_data = (float*)malloc(num_frames * sizeof(float));
-			for(int f=0; f<num_frames; ++f)
-				sample->sample_data[f] = (1.0f / 128.0f) * sample_data[f];
-		}
+		if(checkpoint != NULL)
+			restore_checkpoint(modplayer, checkpoint);
 		else
-		{
-			sample->sample_data = NULL;
-		}
-	
-		sample_data += sample->length;
+			modplayer_reset_song_to_beginning(modplayer);
 	}
 
-	return modplayer_create_player(mod);
+	// and step the rest of the way without mixing
+	while(modplayer->position_frames < target_frame)
+	{
+		unsigned long long frames = mp_min(target_frame - modplayer->position_frames, 0x40000000ull);
+		play_frames(modplayer, (unsigned int)frames, NULL, NULL);
+	}
 }
 
-void modplayer_free(mp_mod_player* modplayer)
+bool modplayer_seek_order(mp_mod_player* modplayer, int order)
 {
-	if(modplayer == NULL)
-		return;
+	leave_render_cache(modplayer);
+	if(order < 0 || order >= modplayer->mod->song_length)
+		return false;
 
-	mp_mod* mod = modplayer->mod;
-	if(mod != NULL)
+	mp_seek_index* index = modplayer->seek_index;
+	if(index == NULL || index->sample_rate != modplayer->output_sample_rate)
+	{
+		if(!modplayer_build_seek_index(modplayer))
+			return false;
+		index = modplayer->seek_index;
+	}
+
+	for(int i=0; i<index->num_checkpoints; ++i)
 	{
-		for(int i=0; i<mod->num_samples; ++i)
+		if(index->checkpoints[i].pattern_idx == order)
 		{
-			mp_sample* sample = &mod->samples[i];
-			if(sample->sample_data != NULL)
-				free(sample->sample_data);
+			restore_checkpoint(modplayer, &index->checkpoints[i]);
+			modplayer->pending_events = SeqEvent_NewLine | SeqEvent_NewOrder; // not whatever loop led there
+			return true;
 		}
-		free(mod->name);
-		free(mod->samples);
-		free(mod->patterns);
-		free(mod);
 	}
 
-	free(modplayer->channel_state);
-	free(modplayer->mix_buffer);
-	free(modplayer->final_buffer);
-	free(modplayer);
+	// this order is never played if the song is played from the start, so just jump straight to it
+	reset_player(modplayer, order);
+	return true;
 }
 
-void modplayer_set_sample_rate(mp_mod_player* modplayer, unsigned int sample_rate)
+// play the song from the start, one line at a time, until it gets to a line it has already played or to
+// the given line. only for working out timings: the tick effects don't run and the voices don't move.
+// returns the number of frames played, and the sequencer is left on the line it stopped at
+static unsigned long long run_sequencer(mp_mod_player* sequencer, int stop_order, int stop_line)
 {
-	modplayer->output_sample_rate = sample_rate;
+	reset_player(sequencer, 0);
+
+	mp_line_history history;
+	start_line_history(&history, sequencer->mod->song_length, sequencer->pattern_idx, sequencer->line_idx);
+
+	unsigned long long frames = 0;
+	while(sequencer->pattern_idx != stop_order || sequencer->line_idx != stop_line)
+	{
+		// the bpm only changes at the start of a line, so every tick of a line is the same length
+		frames += (unsigned long long)(sequencer->speed + sequencer->pattern_delay) * sequencer->frames_until_next_tick;
+
+		int events = next_line(sequencer);
+		if(!add_line_to_history(&history, sequencer->pattern_idx, sequencer->line_idx, events))
+			break;
+	}
+	return frames;
 }
 
-void modplayer_set_stereo(mp_mod_player* modplayer, bool is_stereo)
+bool modplayer_measure_song(mp_mod_player* modplayer, unsigned long long* song_frames, unsigned long long* loop_frame)
 {
-	modplayer->output_channel_count = is_stereo ? 2 : 1;
+	leave_render_cache(modplayer);
+
+	// run a sequencer of its own, so the real player carries on where it was. it only gets the settings and
+	// the mod: no hooks or event callback to call for the dry run, and no command queue, which other
+	// threads may be posting to
+	mp_mod_player sequencer;
+	memset(&sequencer, 0x00, sizeof(sequencer));
+	sequencer.output_sample_rate = modplayer->output_sample_rate;
+	sequencer.output_channel_count = modplayer->output_channel_count;
+	sequencer.step_per_period = modplayer->step_per_period;
+	sequencer.stereo_width = modplayer->stereo_width;
+	sequencer.interpolation = modplayer->interpolation;
+	sequencer.muted_mask = modplayer->muted_mask;
+	sequencer.mod = modplayer->mod;
+	sequencer.channel_state = (mp_channel_state*)MP_MALLOC(sizeof(mp_channel_state) * modplayer->mod->num_channels);
+	if(sequencer.channel_state == NULL)
+	{
+		fprintf(stderr, "Error measuring song, out of memory\n");
+		return false;
+	}
+	memcpy(sequencer.channel_state, modplayer->channel_state, sizeof(mp_channel_state) * modplayer->mod->num_channels);
+
+	*song_frames = run_sequencer(&sequencer, -1, -1);
+
+	// the song carries on from where the line it stopped on was first played
+	if(loop_frame != NULL)
+		*loop_frame = run_sequencer(&sequencer, sequencer.pattern_idx, sequencer.line_idx);
+
+	MP_FREE(sequencer.channel_state);
+	return true;
 }
 
-void modplayer_set_stereo_width(mp_mod_player* modplayer, float stereo_width)
+bool modplayer_post_command(mp_mod_player* modplayer, mp_command_type type, int arg, float value)
 {
-	modplayer->stereo_width = stereo_width;
+	// claim the next position, unless the queue is full (the slot there hasn't been freed since the last time round)
+	unsigned int pos = mp_atomic_load(&modplayer->command_head);
+	mp_command* slot;
+	for(;;)
+	{
+		slot = &modplayer->commands[pos % MP_COMMAND_QUEUE_SIZE];
+		int diff = (int)(mp_atomic_load(&slot->sequence) - pos);
+		if(diff < 0)
+			return false;
+		if(diff == 0 && mp_atomic_cas(&modplayer->command_head, &pos, pos + 1))
+			break;
+		if(diff > 0)
+			pos = mp_atomic_load(&modplayer->command_head); // someone else got there first
+	}
+
+	slot->type = type;
+	slot->arg = arg;
+	slot->value = value;
+	mp_atomic_store(&slot->sequence, pos + 1);
+	return true;
 }
 
-void modplayer_reset_song_to_beginning(mp_mod_player* modplayer)
+static void run_command(mp_mod_player* modplayer, const mp_command* command)
 {
-	modplayer->pattern_idx = 0;
-	modplayer->line_idx = 0;
-	modplayer->tick_idx = 0;
-
-	execute_line(modplayer);
+	leave_render_cache(modplayer);
+	switch(command->type)
+	{
+	case MP_COMMAND_SET_STEREO_WIDTH:
+		modplayer_set_stereo_width(modplayer, command->value);
+		break;
+	case MP_COMMAND_SET_INTERPOLATION:
+		modplayer_set_interpolation(modplayer, (mp_interpolation)command->arg);
+		break;
+	case MP_COMMAND_MUTE_CHANNEL:
+		modplayer_set_channel_muted(modplayer, command->arg, command->value != 0.0f);
+		break;
+	case MP_COMMAND_JUMP_TO_ORDER:
+		if(command->arg < 0 || command->arg >= modplayer->mod->song_length)
+			break;
+		// without an index, the jump takes the player off the song's timeline (see reset_player)
+		if(modplayer->seek_index != NULL && modplayer->seek_index->sample_rate == modplayer->output_sample_rate)
+			modplayer_seek_order(modplayer, command->arg);
+		else
+			reset_player(modplayer, command->arg);
+		break;
+	case MP_COMMAND_RESET_SONG:
+		modplayer_reset_song_to_beginning(modplayer);
+		break;
+	}
 }
 
-void modplayer_decode_frames_f(mp_mod_player* modplayer, unsigned int frame_count, float* buffer)
+// run the commands posted since the last time. no more than a queue's worth, so a thread that
+// keeps posting can't hold the decoder up
+static void run_commands(mp_mod_player* modplayer)
 {
-	unsigned int frames_remaining = frame_count;
-	float* out_buf = buffer;
-	while(frames_remaining > 0)
+	for(int i=0; i<MP_COMMAND_QUEUE_SIZE; ++i)
 	{
-		int num_frames = mp_min(frames_remaining, 1024);
-		num_frames = mp_min(modplayer->frames_until_next_tick, num_frames);
+		unsigned int pos = modplayer->command_tail;
+		mp_command* slot = &modplayer->commands[pos % MP_COMMAND_QUEUE_SIZE];
+		if(mp_atomic_load(&slot->sequence) != pos + 1)
+			break;
 
-		output_frames(modplayer, num_frames, out_buf);
+		run_command(modplayer, slot);
+		modplayer->command_tail = pos + 1;
+		mp_atomic_store(&slot->sequence, pos + MP_COMMAND_QUEUE_SIZE);
+	}
+}
 
-		out_buf += num_frames * modplayer->output_channel_count;
-		modplayer->frames_until_next_tick -= num_frames;
-		frames_remaining -= num_frames;
+static bool commands_pending(mp_mod_player* modplayer)
+{
+	unsigned int pos = modplayer->command_tail;
+	return mp_atomic_load(&modplayer->commands[pos % MP_COMMAND_QUEUE_SIZE].sequence) == pos + 1;
+}
 
-		if(modplayer->frames_until_next_tick == 0)
-		{
-			modplayer->tick_idx++;
-			if(modplayer->tick_idx == (modplayer->speed + modplayer->pattern_delay))
-			{
-				modplayer->tick_idx = 0;
-				modplayer->pattern_delay = 0;
-				modplayer->line_idx++;
+// the decode calls have got to the start of a tick, frame frames into their buffer. the posted commands are
+// run there first, then the event callback is told about the tick, which is wherever the commands left the player
+static void start_decoded_tick(mp_mod_player* modplayer, unsigned int frame)
+{
+	run_commands(modplayer);
+	if(modplayer->event_pending && modplayer->event_callback != NULL)
+		send_event(modplayer, modplayer->pending_events, frame, modplayer->position_frames, modplayer->tick_idx);
+	modplayer->event_pending = false;
+}
 
-				if(modplayer->do_position_jump || modplayer->line_idx >= 64) //modplayer->mod->patterns[modplayer->mod->pattern_table[modplayer->pattern_idx]].length)
-				{
-					int old_pattern_idx = modplayer->pattern_idx;
+// play frames for the decode calls: the same as play_frames(), but the posted commands are run at each tick
+// boundary (before the event callback is told about it), and lines go through the render cache if there is one
+static void decode_frames(mp_mod_player* modplayer, unsigned int frame_count, float* buffer_f, short* buffer)
+{
+	mp_render_cache* cache = modplayer->render_cache;
+	unsigned int out_channels = modplayer->output_channel_count;
+	unsigned int frame = 0;
 
-					if(modplayer->do_position_jump)
-					{
-						modplayer->line_idx = modplayer->position_jump_line_idx;
-						modplayer->pattern_idx = modplayer->position_jump_pat_idx;
-						modplayer->do_position_jump = false;
-					}
-					else
-					{
-						modplayer->line_idx = 0;
-						modplayer->pattern_idx++;
-					}
+	// after a reset or a seek the player can be right at the start of a tick that hasn't been reported
+	if(modplayer->event_pending)
+		start_decoded_tick(modplayer, 0);
 
-					if(modplayer->pattern_idx >= modplayer->mod->song_length)
-					{
-						// end of song;
-						modplayer->pattern_idx = 0; // loop
-					}
+	while(frame_count > 0)
+	{
+		if(cache != NULL)
+		{
+			// commands can change anything, so they're run on the player itself, not on a cached line
+			if(commands_pending(modplayer))
+				leave_render_cache(modplayer);
+			if(cache->playing == NULL && cache->recording == NULL && modplayer->tick_idx == 0 &&
+				modplayer->frames_until_next_tick == frames_per_tick(modplayer))
+				start_cached_line(modplayer);
+		}
 
-					if(modplayer->pattern_idx != old_pattern_idx)
-					{
-						// new pattern, so reset the loop points
-						for(int i=0; i<modplayer->mod->num_channels; ++i)
-						{
-							modplayer->channel_state[i].loop_start = 0;
-							modplayer->channel_state[i].loop_count = 0;
-						}
-					}
+		unsigned int num_frames;
+		if(cache != NULL && cache->playing != NULL)
+		{
+			num_frames = copy_cached_frames(modplayer, frame_count, buffer_f, buffer, frame);
+			if(cache->playing == NULL)
+				start_decoded_tick(modplayer, frame + num_frames);
+		}
+		else
+		{
+			num_frames = mp_min(frame_count, (unsigned int)modplayer->frames_until_next_tick);
+			bool tick_ends = num_frames == (unsigned int)modplayer->frames_until_next_tick;
+			if(cache != NULL && cache->recording != NULL && cache->line_frame + num_frames > cache->recording->num_frames)
+				cache->recording = NULL; // never happens, unless the line's length was worked out wrong
+			if(cache != NULL && cache->recording != NULL)
+			{
+				// mix into the cache, and copy from there
+				float* frames = cache_entry_frames(cache, cache->recording) + cache->line_frame * out_channels;
+				play_frames(modplayer, num_frames, frames, NULL);
+				if(buffer_f != NULL)
+					memcpy(buffer_f, frames, num_frames * out_channels * sizeof(float));
+				if(buffer != NULL)
+					convert_to_int16(frames, num_frames * out_channels, buffer);
+
+				cache->line_frame += num_frames;
+				if(tick_ends && modplayer->tick_idx == 0)
+				{
+					if(cache->line_frame == cache->recording->num_frames)
+						finish_cached_line(modplayer);
+					else
+						cache->recording = NULL;
 				}
-					
-				execute_line(modplayer);				
 			}
 			else
 			{
-				execute_tick(modplayer);
+				play_frames(modplayer, num_frames, buffer_f, buffer);
 			}
+
+			if(tick_ends)
+				start_decoded_tick(modplayer, frame + num_frames);
 		}
+
+		if(buffer_f != NULL)
+			buffer_f += num_frames * out_channels;
+		if(buffer != NULL)
+			buffer += num_frames * out_channels;
+		frame_count -= num_frames;
+		frame += num_frames;
 	}
 }
 
+void modplayer_decode_frames_f(mp_mod_player* modplayer, unsigned int frame_count, float* buffer)
+{
+	decode_frames(modplayer, frame_count, buffer, NULL);
+}
+
 void modplayer_decode_frames(mp_mod_player *modplayer, unsigned int frame_count, short *buffer)
 {
-	unsigned int frames_remaining = frame_count;
-	short* out_buf = buffer;
+	decode_frames(modplayer, frame_count, NULL, buffer);
+}
 
-	while(frames_remaining > 0)
+void modplayer_decode_frames_batch_f(mp_mod_player** players, unsigned int num_players, unsigned int frame_count, float** buffers)
+{
+	for(unsigned int i=0; i<num_players; ++i)
+		decode_frames(players[i], frame_count, buffers[i], NULL);
+}
+
+void modplayer_decode_frames_batch(mp_mod_player** players, unsigned int num_players, unsigned int frame_count, short** buffers)
+{
+	for(unsigned int i=0; i<num_players; ++i)
+		decode_frames(players[i], frame_count, NULL, buffers[i]);
+}
+
+void modplayer_decode_stems_f(mp_mod_player* modplayer, unsigned int frame_count, float** stems, float* buffer)
+{
+	leave_render_cache(modplayer);
+
+	// the same steps as play_frames() and decode_frames(), with the channels mixed by mix_channels()
+	unsigned int out_channels = modplayer->output_channel_count;
+	unsigned int frame = 0;
+	if(modplayer->event_pending)
+		start_decoded_tick(modplayer, 0);
+	while(frame < frame_count)
 	{
-		int num_frames = mp_min(frames_remaining, 1024);
-		modplayer_decode_frames_f(modplayer, num_frames, modplayer->final_buffer);
+		int num_frames = mp_min(frame_count - frame, 1024);
+		num_frames = mp_min(modplayer->frames_until_next_tick, num_frames);
 
-		for(unsigned int i=0; i<num_frames * modplayer->output_channel_count; ++i)
-			out_buf[i] = (short)(modplayer->final_buffer[i] * 32767.0f);
+		float* out_buf_f = buffer != NULL ? &buffer[frame * out_channels] : NULL;
+		mix_channels(modplayer, num_frames, out_buf_f, stems, frame * out_channels);
+#if defined(MOD_PLAYER_STATS)
+		if(out_buf_f != NULL)
+			modplayer->stats.clipped_samples += count_clipped(out_buf_f, num_frames * out_channels);
+#endif
 
-		frames_remaining -= num_frames;
-		out_buf += num_frames * modplayer->output_channel_count;
+		modplayer->frames_until_next_tick -= num_frames;
+		modplayer->position_frames += num_frames;
+		modplayer->event_pending = false;
+		frame += num_frames;
+
+		if(modplayer->frames_until_next_tick == 0)
+		{
+			next_tick(modplayer);
+			start_decoded_tick(modplayer, frame);
+		}
+	}
+}
+
+int modplayer_get_num_channels(mp_mod_player* modplayer)
+{
+	return modplayer->mod->num_channels;
+}
+
+// one part of a song render, see render_song()
+typedef struct mp_render_job
+{
+	mp_mod_player player; // a copy of the player, starting at a checkpoint
+	unsigned int frame_count;
+	float* buffer_f;
+	short* buffer;
+} mp_render_job;
+
+static void run_render_job(mp_render_job* job)
+{
+	play_frames(&job->player, job->frame_count, job->buffer_f, job->buffer);
+}
+
+#if defined(MOD_PLAYER_THREADS)
+#if defined(_WIN32)
+static DWORD WINAPI render_job_thread(LPVOID job)
+{
+	run_render_job((mp_render_job*)job);
+	return 0;
+}
+#else
+static void* render_job_thread(void* job)
+{
+	run_render_job((mp_render_job*)job);
+	return NULL;
+}
+#endif
+#endif // MOD_PLAYER_THREADS
+
+// render the start of the song in pieces that begin at the seek index checkpoints, one piece per thread.
+// the checkpoints were taken by playing the song through with play_frames(), so each piece starts in
+// exactly the state a single render would have got to, and the output is the same bit for bit
+static bool render_song(mp_mod_player* modplayer, unsigned int frame_count, float* buffer_f, short* buffer, int num_threads)
+{
+	leave_render_cache(modplayer);
+	mp_seek_index* index = modplayer->seek_index;
+	if(index == NULL || index->sample_rate != modplayer->output_sample_rate)
+	{
+		if(!modplayer_build_seek_index(modplayer))
+			return false;
+		index = modplayer->seek_index;
+	}
+
+	// pick the checkpoints closest to splitting the frames evenly between the threads
+	int starts[128];
+	int num_jobs = 1;
+	starts[0] = 0;
+	num_threads = mp_clamp(num_threads, 1, index->num_checkpoints);
+	for(int i=1; i<index->num_checkpoints && num_jobs < num_threads; ++i)
+	{
+		unsigned long long frame = index->checkpoints[i].position_frames;
+		unsigned long long job_start = (unsigned long long)frame_count * num_jobs / num_threads;
+		if(frame >= frame_count)
+			break;
+		if(frame >= job_start)
+			starts[num_jobs++] = i;
+	}
+
+	// the jobs, and their channel states (plus one set for the end state), in one block
+	int num_channels = modplayer->mod->num_channels;
+	size_t states_offset = MP_BLOCK_ALIGN(sizeof(mp_render_job) * num_jobs);
+	unsigned char* block = (unsigned char*)MP_MALLOC(states_offset + sizeof(mp_channel_state) * num_channels * (num_jobs + 1));
+	if(block == NULL)
+		return false;
+
+	mp_render_job* jobs = (mp_render_job*)block;
+	mp_channel_state* channel_states = (mp_channel_state*)(block + states_offset);
+
+	unsigned int out_channels = modplayer->output_channel_count;
+	for(int i=0; i<num_jobs; ++i)
+	{
+		mp_render_job* job = &jobs[i];
+		const mp_checkpoint* checkpoint = &index->checkpoints[starts[i]];
+		unsigned long long end_frame = i+1 < num_jobs ? index->checkpoints[starts[i+1]].position_frames : frame_count;
+
+		job->player = *modplayer;
+		job->player.channel_state = &channel_states[i * num_channels];
+		job->player.seek_index = NULL;
+		MP_STATS(memset(&job->player.stats, 0x00, sizeof(mp_stats)));
+		restore_checkpoint(&job->player, checkpoint);
+
+		job->frame_count = (unsigned int)(end_frame - checkpoint->position_frames);
+		job->buffer_f = buffer_f != NULL ? &buffer_f[checkpoint->position_frames * out_channels] : NULL;
+		job->buffer = buffer != NULL ? &buffer[checkpoint->position_frames * out_channels] : NULL;
+	}
+
+#if defined(MOD_PLAYER_THREADS)
+	// the calling thread does the first piece itself. if a thread can't be started its piece is done here too
+#if defined(_WIN32)
+	HANDLE threads[128];
+	for(int i=1; i<num_jobs; ++i)
+		threads[i] = CreateThread(NULL, 0, render_job_thread, &jobs[i], 0, NULL);
+	run_render_job(&jobs[0]);
+	for(int i=1; i<num_jobs; ++i)
+	{
+		if(threads[i] != NULL)
+		{
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		}
+		else
+			run_render_job(&jobs[i]);
+	}
+#else
+	pthread_t threads[128];
+	bool started[128];
+	for(int i=1; i<num_jobs; ++i)
+		started[i] = pthread_create(&threads[i], NULL, render_job_thread, &jobs[i]) == 0;
+	run_render_job(&jobs[0]);
+	for(int i=1; i<num_jobs; ++i)
+	{
+		if(started[i])
+			pthread_join(threads[i], NULL);
+		else
+			run_render_job(&jobs[i]);
+	}
+#endif
+#else
+	for(int i=0; i<num_jobs; ++i)
+		run_render_job(&jobs[i]);
+#endif // MOD_PLAYER_THREADS
+
+	// leave the player where a single render would have left it
+	mp_checkpoint end;
+	end.channel_state = &channel_states[num_jobs * num_channels];
+	save_checkpoint(&jobs[num_jobs - 1].player, &end);
+	restore_checkpoint(modplayer, &end);
+#if defined(MOD_PLAYER_STATS)
+	for(int i=0; i<num_jobs; ++i)
+		add_stats(&modplayer->stats, &jobs[i].player.stats);
+#endif
+
+	MP_FREE(block);
+	return true;
+}
+
+bool modplayer_render_song_f(mp_mod_player* modplayer, unsigned int frame_count, float* buffer, int num_threads)
+{
+	return render_song(modplayer, frame_count, buffer, NULL, num_threads);
+}
+
+bool modplayer_render_song(mp_mod_player* modplayer, unsigned int frame_count, short* buffer, int num_threads)
+{
+	return render_song(modplayer, frame_count, NULL, buffer, num_threads);
+}
+
+#if defined(MOD_PLAYER_THREADS)
+struct mp_async_player
+{
+	mp_mod_player* modplayer;	// only used by the render thread while it runs
+	float* ring;				// ring_frames frames of output, allocated along with the async player
+	unsigned int ring_frames;	// a power of 2
+	unsigned int out_channels;
+	unsigned int watermark;		// the ring is topped up when fewer frames than this are left in it
+	unsigned int poll_ms;		// how often the render thread checks, a quarter of the watermark's length
+
+	// the positions count frames from the start and wrap at 2^32, so write_pos - read_pos is how much is buffered.
+	// each side only writes its own, and they're kept on separate cache lines so the threads don't fight over them
+	unsigned int write_pos;		// written by the render thread
+	char write_pad[64];
+	unsigned int read_pos;		// written by the reader, along with the underrun counts
+	unsigned int underruns;
+	unsigned int underrun_frames;
+	char read_pad[64];
+
+	unsigned int running;		// cleared by modplayer_async_free() to stop the thread
+#if defined(_WIN32)
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+};
+
+static void sleep_ms(unsigned int ms)
+{
+#if defined(_WIN32)
+	Sleep(ms);
+#else
+	poll(NULL, 0, (int)ms);
+#endif
+}
+
+// decode into the ring until it's full, publishing each piece as soon as it's done
+static void fill_ring(mp_async_player* async)
+{
+	unsigned int write_pos = async->write_pos;
+	unsigned int buffered = write_pos - mp_atomic_load(&async->read_pos);
+	while(buffered < async->ring_frames)
+	{
+		unsigned int offset = write_pos & (async->ring_frames - 1);
+		unsigned int num_frames = mp_min(async->ring_frames - buffered, async->ring_frames - offset);
+		num_frames = mp_min(num_frames, 1024);
+		decode_frames(async->modplayer, num_frames, &async->ring[offset * async->out_channels], NULL);
+
+		write_pos += num_frames;
+		buffered += num_frames;
+		mp_atomic_store(&async->write_pos, write_pos);
+	}
+}
+
+static void run_async_player(mp_async_player* async)
+{
+	while(mp_atomic_load(&async->running))
+	{
+		if(async->write_pos - mp_atomic_load(&async->read_pos) < async->watermark)
+			fill_ring(async);
+		else
+			sleep_ms(async->poll_ms);
+	}
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI async_player_thread(LPVOID async)
+{
+	run_async_player((mp_async_player*)async);
+	return 0;
+}
+#else
+static void* async_player_thread(void* async)
+{
+	run_async_player((mp_async_player*)async);
+	return NULL;
+}
+#endif
+
+mp_async_player* modplayer_async_create(mp_mod_player* modplayer, unsigned int buffer_frames, unsigned int watermark)
+{
+	unsigned int ring_frames = 256;
+	while(ring_frames < buffer_frames && ring_frames < (1u << 30))
+		ring_frames *= 2;
+
+	unsigned int out_channels = modplayer->output_channel_count;
+	size_t ring_offset = MP_BLOCK_ALIGN(sizeof(mp_async_player));
+	unsigned char* block = (unsigned char*)MP_MALLOC(ring_offset + (size_t)ring_frames * out_channels * sizeof(float));
+	if(block == NULL)
+	{
+		fprintf(stderr, "Error creating async player, out of memory\n");
+		return NULL;
+	}
+
+	mp_async_player* async = (mp_async_player*)block;
+	memset(async, 0x00, sizeof(mp_async_player));
+	async->modplayer = modplayer;
+	async->ring = (float*)(block + ring_offset);
+	async->ring_frames = ring_frames;
+	async->out_channels = out_channels;
+	async->watermark = watermark == 0 || watermark > ring_frames ? ring_frames / 2 : watermark;
+	async->poll_ms = (unsigned int)mp_max((unsigned long long)async->watermark * 250 / modplayer->output_sample_rate, 1ull);
+	async->running = 1;
+
+	fill_ring(async);
+
+#if defined(_WIN32)
+	async->thread = CreateThread(NULL, 0, async_player_thread, async, 0, NULL);
+	bool started = async->thread != NULL;
+#else
+	bool started = pthread_create(&async->thread, NULL, async_player_thread, async) == 0;
+#endif
+	if(!started)
+	{
+		fprintf(stderr, "Error creating async player, couldn't start the render thread\n");
+		MP_FREE(block);
+		return NULL;
+	}
+
+	return async;
+}
+
+void modplayer_async_free(mp_async_player* async)
+{
+	if(async == NULL)
+		return;
+
+	mp_atomic_store(&async->running, 0);
+#if defined(_WIN32)
+	WaitForSingleObject(async->thread, INFINITE);
+	CloseHandle(async->thread);
+#else
+	pthread_join(async->thread, NULL);
+#endif
+	MP_FREE(async);
+}
+
+// copy frames out of the ring, into buffer_f as floats or buffer as 16 bit, and fill in any shortfall with silence
+static unsigned int read_ring(mp_async_player* async, unsigned int frame_count, float* buffer_f, short* buffer)
+{
+	unsigned int out_channels = async->out_channels;
+	unsigned int read_pos = async->read_pos;
+	unsigned int num_frames = mp_min(frame_count, mp_atomic_load(&async->write_pos) - read_pos);
+
+	// in up to two pieces, either side of the end of the ring
+	unsigned int done = 0;
+	while(done < num_frames)
+	{
+		unsigned int offset = (read_pos + done) & (async->ring_frames - 1);
+		unsigned int piece = mp_min(num_frames - done, async->ring_frames - offset);
+		const float* ring = &async->ring[offset * out_channels];
+		if(buffer != NULL)
+			convert_to_int16(ring, piece * out_channels, &buffer[done * out_channels]);
+		else
+			memcpy(&buffer_f[done * out_channels], ring, piece * out_channels * sizeof(float));
+		done += piece;
+	}
+	mp_atomic_store(&async->read_pos, read_pos + num_frames);
+
+	if(num_frames < frame_count)
+	{
+		unsigned int missing = frame_count - num_frames;
+		if(buffer != NULL)
+			memset(&buffer[num_frames * out_channels], 0x00, missing * out_channels * sizeof(short));
+		else
+			memset(&buffer_f[num_frames * out_channels], 0x00, missing * out_channels * sizeof(float));
+		mp_atomic_store(&async->underruns, async->underruns + 1);
+		mp_atomic_store(&async->underrun_frames, async->underrun_frames + missing);
 	}
+
+	return num_frames;
+}
+
+unsigned int modplayer_async_read(mp_async_player* async, unsigned int frame_count, short* buffer)
+{
+	return read_ring(async, frame_count, NULL, buffer);
+}
+
+unsigned int modplayer_async_read_f(mp_async_player* async, unsigned int frame_count, float* buffer)
+{
+	return read_ring(async, frame_count, buffer, NULL);
+}
+
+unsigned int modplayer_async_buffered_frames(mp_async_player* async)
+{
+	return mp_atomic_load(&async->write_pos) - mp_atomic_load(&async->read_pos);
+}
+
+void modplayer_async_get_underruns(mp_async_player* async, unsigned int* underruns, unsigned int* underrun_frames)
+{
+	if(underruns != NULL)
+		*underruns = mp_atomic_load(&async->underruns);
+	if(underrun_frames != NULL)
+		*underrun_frames = mp_atomic_load(&async->underrun_frames);
 }
+#endif // MOD_PLAYER_THREADS
 
 #endif // MOD_PLAYER_IMPLEMENTATION
 
@@ -0,0 +1,519 @@
+/*
+ Transcodes mods to wav files in bulk. Every .mod file in the given directories (and their subdirectories),
+ and any mod files named directly, is rendered from the start to where the song ends or starts to loop (see
+ modplayer_measure_song()) and saved as a 16 bit stereo wav file, next to the mod or in the output directory.
+ In the output directory each file keeps its path under the directory it was found in, so a/x.mod and b/x.mod
+ in the same library don't end up in the same wav. Files that would still be written to the same wav are skipped.
+ The files are shared out between a pool of threads, each rendering one file at a time with a player of its own.
+
+ Compile with:
+ gcc transcode.c -o transcode -std=c99 -O2 -pthread
+
+ Run:
+ transcode [-j threads] [-r sample_rate] [-m max_seconds] [-o output_dir] <directory or modfile.mod> [more ...]
+
+ threads defaults to the number of cpus, and the sample rate to 44100. songs that loop forever without any
+ repeated lines are cut off at max_seconds (default 3600)
+
+*/
+
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L // for clock_gettime, stat, opendir and sysconf
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MOD_PLAYER_THREADS
+#define MOD_PLAYER_IMPLEMENTATION
+#include "modplayer.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#define MAX_THREADS 256
+#define WRITE_FRAMES 65536 // frames per fwrite(): 256KB of 16 bit stereo
+
+static double now_seconds(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+static int num_cpus(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+// the files to transcode, gathered before any threads start
+typedef struct file_list
+{
+	char** names;
+	unsigned int* relative; // where the path under the output directory starts in each name
+	unsigned int count;
+	unsigned int capacity;
+} file_list;
+
+static bool is_separator(char c)
+{
+	return c == '/' || c == '\\';
+}
+
+// add a file, which goes in the output directory under name + relative
+static void add_file(file_list* files, const char* name, unsigned int relative)
+{
+	if(files->count == files->capacity)
+	{
+		files->capacity = files->capacity > 0 ? files->capacity * 2 : 256;
+		files->names = (char**)realloc(files->names, files->capacity * sizeof(char*));
+		files->relative = (unsigned int*)realloc(files->relative, files->capacity * sizeof(unsigned int));
+	}
+	size_t len = strlen(name);
+	files->names[files->count] = (char*)malloc(len + 1);
+	memcpy(files->names[files->count], name, len + 1);
+	files->relative[files->count] = relative;
+	files->count++;
+}
+
+// add a file named directly, which goes in the output directory under its base name
+static void add_named_file(file_list* files, const char* name)
+{
+	unsigned int relative = 0;
+	for(unsigned int i=0; name[i] != '\0'; ++i)
+	{
+		if(is_separator(name[i]))
+			relative = i + 1;
+	}
+	add_file(files, name, relative);
+}
+
+static bool has_mod_extension(const char* name)
+{
+	size_t len = strlen(name);
+	if(len < 4)
+		return false;
+	const char* ext = &name[len - 4];
+	return ext[0] == '.' && tolower(ext[1]) == 'm' && tolower(ext[2]) == 'o' && tolower(ext[3]) == 'd';
+}
+
+// add the .mod files in a directory and its subdirectories. relative is where the path under the directory
+// named on the command line starts
+static void add_directory(file_list* files, const char* dir, unsigned int relative)
+{
+	char path[4096];
+#if defined(_WIN32)
+	snprintf(path, sizeof(path), "%s\\*", dir);
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA(path, &found);
+	if(find == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		if(strcmp(found.cFileName, ".") == 0 || strcmp(found.cFileName, "..") == 0)
+			continue;
+		snprintf(path, sizeof(path), "%s\\%s", dir, found.cFileName);
+		if(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			add_directory(files, path, relative);
+		else if(has_mod_extension(found.cFileName))
+			add_file(files, path, relative);
+	} while(FindNextFileA(find, &found));
+	FindClose(find);
+#else
+	DIR* d = opendir(dir);
+	if(d == NULL)
+		return;
+	struct dirent* entry;
+	while((entry = readdir(d)) != NULL)
+	{
+		if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		struct stat st;
+		if(stat(path, &st) != 0)
+			continue;
+		if(S_ISDIR(st.st_mode))
+			add_directory(files, path, relative);
+		else if(has_mod_extension(entry->d_name))
+			add_file(files, path, relative);
+	}
+	closedir(d);
+#endif
+}
+
+static bool is_directory(const char* path)
+{
+#if defined(_WIN32)
+	DWORD attributes = GetFileAttributesA(path);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+// the wav file for a mod: its name with .wav in place of .mod, in output_dir (under its relative path) if there is one
+static void wav_filename(const char* mod_filename, unsigned int relative, const char* output_dir, char* filename, size_t size)
+{
+	const char* name = output_dir != NULL ? &mod_filename[relative] : mod_filename;
+	int name_len = (int)strlen(name);
+	if(has_mod_extension(name))
+		name_len -= 4;
+
+	if(output_dir != NULL)
+		snprintf(filename, size, "%s/%.*s.wav", output_dir, name_len, name);
+	else
+		snprintf(filename, size, "%.*s.wav", name_len, name);
+}
+
+// create the directories a wav file goes in, output_dir included. ones that are there already are fine
+static void make_directories(const char* filename)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s", filename);
+	for(size_t i=1; path[i] != '\0'; ++i)
+	{
+		if(!is_separator(path[i]))
+			continue;
+		char separator = path[i];
+		path[i] = '\0';
+#if defined(_WIN32)
+		CreateDirectoryA(path, NULL);
+#else
+		mkdir(path, 0777);
+#endif
+		path[i] = separator;
+	}
+}
+
+typedef struct wav_entry
+{
+	char* filename;
+	unsigned int index;
+} wav_entry;
+
+static int compare_wav_entries(const void* a, const void* b)
+{
+	return strcmp(((const wav_entry*)a)->filename, ((const wav_entry*)b)->filename);
+}
+
+// take out every file that would be written to the same wav as another one, so no two threads write the
+// same wav at once. returns the number taken out
+static unsigned int remove_clashes(file_list* files, const char* output_dir)
+{
+	wav_entry* entries = (wav_entry*)malloc(files->count * sizeof(wav_entry));
+	char filename[4096];
+	for(unsigned int i=0; i<files->count; ++i)
+	{
+		wav_filename(files->names[i], files->relative[i], output_dir, filename, sizeof(filename));
+		size_t len = strlen(filename);
+		entries[i].filename = (char*)malloc(len + 1);
+		memcpy(entries[i].filename, filename, len + 1);
+		entries[i].index = i;
+	}
+	qsort(entries, files->count, sizeof(wav_entry), compare_wav_entries);
+
+	unsigned int num_clashes = 0;
+	for(unsigned int i=0; i<files->count; ++i)
+	{
+		bool clash = (i > 0 && strcmp(entries[i].filename, entries[i - 1].filename) == 0) ||
+			(i + 1 < files->count && strcmp(entries[i].filename, entries[i + 1].filename) == 0);
+		if(!clash)
+			continue;
+		fprintf(stderr, "Skipped %s, another file would be written to %s too\n", files->names[entries[i].index], entries[i].filename);
+		free(files->names[entries[i].index]);
+		files->names[entries[i].index] = NULL;
+		num_clashes++;
+	}
+	for(unsigned int i=0; i<files->count; ++i)
+		free(entries[i].filename);
+	free(entries);
+
+	// close up the gaps, keeping the files in order
+	unsigned int count = 0;
+	for(unsigned int i=0; i<files->count; ++i)
+	{
+		if(files->names[i] == NULL)
+			continue;
+		files->names[count] = files->names[i];
+		files->relative[count] = files->relative[i];
+		count++;
+	}
+	files->count = count;
+	return num_clashes;
+}
+
+// the 44 byte header of a 16 bit pcm wav file
+static void write_wav_header(unsigned char* header, unsigned int sample_rate, unsigned int channel_count, unsigned int data_size)
+{
+	unsigned int values[] = { 36 + data_size, 16, sample_rate, sample_rate * channel_count * 2, data_size };
+	memcpy(&header[0], "RIFF", 4);
+	memcpy(&header[8], "WAVEfmt ", 8);
+	memcpy(&header[36], "data", 4);
+	for(int b=0; b<4; ++b)
+	{
+		header[4 + b] = (unsigned char)(values[0] >> (8 * b)); // file size, less the first 8 bytes
+		header[16 + b] = (unsigned char)(values[1] >> (8 * b)); // block size
+		header[24 + b] = (unsigned char)(values[2] >> (8 * b)); // sample rate
+		header[28 + b] = (unsigned char)(values[3] >> (8 * b)); // byte rate: samplerate * numchannels * bytesperchannel
+		header[40 + b] = (unsigned char)(values[4] >> (8 * b)); // data size
+	}
+	header[20] = 1; header[21] = 0; // linear pcm
+	header[22] = (unsigned char)channel_count; header[23] = 0;
+	header[32] = (unsigned char)(channel_count * 2); header[33] = 0; // block align: numchannels * bytesperchannel
+	header[34] = 16; header[35] = 0; // bits per sample
+}
+
+typedef struct transcoder
+{
+	file_list files;
+	const char* output_dir;
+	unsigned int sample_rate;
+	float max_seconds;
+	unsigned int next_file; // the next file for a worker to take
+} transcoder;
+
+// what one worker did
+typedef struct worker
+{
+	transcoder* tc;
+	unsigned int files_done;
+	unsigned int files_failed;
+	unsigned long long frames; // frames written, in all its files
+} worker;
+
+// render a mod to a wav file. buffer holds WRITE_FRAMES stereo frames. returns the number of frames
+// written, or -1 if the mod couldn't be loaded or the wav file written
+static long long transcode_file(const transcoder* tc, unsigned int index, short* buffer)
+{
+	const char* mod_filename = tc->files.names[index];
+	// the samples are played straight out of the mapped file, nothing is copied
+	mp_mod* mod = modplayer_mod_create_from_file_mapped((char*)mod_filename);
+	mp_mod_player* modplayer = mod != NULL ? modplayer_create_from_mod(mod) : NULL;
+	if(modplayer == NULL)
+	{
+		modplayer_mod_free(mod);
+		return -1;
+	}
+
+	unsigned int channel_count = 2;
+	modplayer_set_sample_rate(modplayer, tc->sample_rate);
+	modplayer_set_stereo_width(modplayer, 0.5f); // reduce stereo effect a bit, as example.c does
+
+	// wav files can't be more than 4GB
+	unsigned long long max_frames = (unsigned long long)((double)tc->max_seconds * tc->sample_rate);
+	max_frames = mp_min(max_frames, 0xffffff00ull / (channel_count * sizeof(short)));
+	unsigned long long song_frames;
+	if(!modplayer_measure_song(modplayer, &song_frames, NULL))
+	{
+		modplayer_free(modplayer);
+		modplayer_mod_free(mod);
+		return -1;
+	}
+	unsigned long long total_frames = mp_min(song_frames, max_frames);
+	modplayer_reset_song_to_beginning(modplayer);
+
+	char filename[4096];
+	wav_filename(mod_filename, tc->files.relative[index], tc->output_dir, filename, sizeof(filename));
+	if(tc->output_dir != NULL)
+		make_directories(filename);
+	FILE* fp = fopen(filename, "wb");
+	bool ok = fp != NULL;
+	if(fp != NULL)
+	{
+		// every write is a big one, so stdio's own buffer would only add a copy
+		setvbuf(fp, NULL, _IONBF, 0);
+
+		unsigned char header[44];
+		write_wav_header(header, tc->sample_rate, channel_count, (unsigned int)(total_frames * channel_count * sizeof(short)));
+		ok = fwrite(header, sizeof(header), 1, fp) == 1;
+
+		unsigned long long frames_remaining = total_frames;
+		while(ok && frames_remaining > 0)
+		{
+			unsigned int num_frames = (unsigned int)mp_min(frames_remaining, WRITE_FRAMES);
+			modplayer_decode_frames(modplayer, num_frames, buffer);
+			ok = fwrite(buffer, num_frames * channel_count * sizeof(short), 1, fp) == 1;
+			frames_remaining -= num_frames;
+		}
+		ok = fclose(fp) == 0 && ok;
+	}
+	if(!ok)
+		fprintf(stderr, "Error writing %s\n", filename);
+
+	modplayer_free(modplayer);
+	modplayer_mod_free(mod);
+	return ok ? (long long)total_frames : -1;
+}
+
+static void run_worker(worker* w)
+{
+	transcoder* tc = w->tc;
+	short* buffer = (short*)malloc(WRITE_FRAMES * 2 * sizeof(short));
+	for(;;)
+	{
+		// take the next file
+		unsigned int index = mp_atomic_load(&tc->next_file);
+		while(index < tc->files.count && !mp_atomic_cas(&tc->next_file, &index, index + 1))
+			;
+		if(index >= tc->files.count)
+			break;
+
+		long long frames = transcode_file(tc, index, buffer);
+		if(frames < 0)
+		{
+			fprintf(stderr, "Skipped %s\n", tc->files.names[index]);
+			w->files_failed++;
+			continue;
+		}
+		w->files_done++;
+		w->frames += (unsigned long long)frames;
+	}
+	free(buffer);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI worker_thread(LPVOID w)
+{
+	run_worker((worker*)w);
+	return 0;
+}
+#else
+static void* worker_thread(void* w)
+{
+	run_worker((worker*)w);
+	return NULL;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+	transcoder tc;
+	memset(&tc, 0x00, sizeof(tc));
+	tc.sample_rate = 44100;
+	tc.max_seconds = 3600.0f;
+	int num_threads = num_cpus();
+
+	int arg = 1;
+	while(arg + 1 < argc && argv[arg][0] == '-')
+	{
+		const char* option = argv[arg];
+		const char* value = argv[arg + 1];
+		if(strcmp(option, "-j") == 0)
+			num_threads = atoi(value);
+		else if(strcmp(option, "-r") == 0)
+			tc.sample_rate = (unsigned int)atoi(value);
+		else if(strcmp(option, "-m") == 0)
+			tc.max_seconds = (float)atof(value);
+		else if(strcmp(option, "-o") == 0)
+			tc.output_dir = value;
+		else
+			break;
+		arg += 2;
+	}
+
+	if(arg >= argc || num_threads < 1 || tc.sample_rate == 0 || tc.max_seconds <= 0.0f)
+	{
+		printf("Usage: transcode [-j threads] [-r sample_rate] [-m max_seconds] [-o output_dir] <directory or modfile.mod> [more ...]\n");
+		exit(0);
+	}
+	num_threads = mp_min(num_threads, MAX_THREADS);
+
+	for(; arg < argc; ++arg)
+	{
+		if(is_directory(argv[arg]))
+			add_directory(&tc.files, argv[arg], (unsigned int)strlen(argv[arg]) + 1);
+		else
+			add_named_file(&tc.files, argv[arg]);
+	}
+	unsigned int files_clashed = remove_clashes(&tc.files, tc.output_dir);
+	if(tc.files.count == 0 && files_clashed == 0)
+	{
+		printf("No mod files found\n");
+		exit(0);
+	}
+
+	num_threads = (int)mp_max(mp_min((unsigned int)num_threads, tc.files.count), 1u);
+	printf("Transcoding %u files on %d threads\n", tc.files.count, num_threads);
+
+	// the main thread is worker 0
+	worker workers[MAX_THREADS];
+	memset(workers, 0x00, sizeof(workers));
+	double start = now_seconds();
+#if defined(_WIN32)
+	HANDLE threads[MAX_THREADS];
+	for(int i=0; i<num_threads; ++i)
+	{
+		workers[i].tc = &tc;
+		threads[i] = i > 0 ? CreateThread(NULL, 0, worker_thread, &workers[i], 0, NULL) : NULL;
+	}
+	run_worker(&workers[0]);
+	for(int i=1; i<num_threads; ++i)
+	{
+		if(threads[i] != NULL)
+		{
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		}
+	}
+#else
+	pthread_t threads[MAX_THREADS];
+	bool started[MAX_THREADS];
+	for(int i=0; i<num_threads; ++i)
+	{
+		workers[i].tc = &tc;
+		started[i] = i > 0 && pthread_create(&threads[i], NULL, worker_thread, &workers[i]) == 0;
+	}
+	run_worker(&workers[0]);
+	for(int i=1; i<num_threads; ++i)
+	{
+		if(started[i])
+			pthread_join(threads[i], NULL);
+	}
+#endif
+	double elapsed = now_seconds() - start;
+
+	// a worker that couldn't be started just leaves its share to the others
+	unsigned int files_done = 0;
+	unsigned int files_failed = files_clashed;
+	unsigned long long frames = 0;
+	for(int i=0; i<num_threads; ++i)
+	{
+		files_done += workers[i].files_done;
+		files_failed += workers[i].files_failed;
+		frames += workers[i].frames;
+	}
+
+	double audio_seconds = (double)frames / tc.sample_rate;
+	printf("%u files (%u skipped) in %.2f s: %.1f files/s, %.0f s of audio, %.0fx realtime\n",
+		files_done, files_failed, elapsed, files_done / elapsed, audio_seconds, audio_seconds / elapsed);
+
+	for(unsigned int i=0; i<tc.files.count; ++i)
+		free(tc.files.names[i]);
+	free(tc.files.names);
+	free(tc.files.relative);
+	return files_failed > 0 ? 1 : 0;
+}
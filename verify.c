@@ -0,0 +1,471 @@
+/*
+ Checks that a build of the modplayer plays mods the same as a reference build, for trying out the simd
+ kernels, fixed point, C++ or anything else before turning it on. Each mod is rendered a few ways: stereo
+ float with every interpolation mode, mono float, and stereo 16 bit, all decoded in 1024 frame calls, and
+ stereo float decoded in calls of random sizes. For each render it reports
+	- the realtime factor (seconds of audio decoded per second of cpu), and how that compares to the reference
+	- a hash of the output, which is the same on every run of the same build
+	- the largest and the RMS difference from the reference render, in 16 bit steps
+	- for the random sized calls, the largest difference from the same render in 1024 frame calls. how the
+	  decoding is split up mustn't change the output at all, so anything but 0 fails
+ Before the mods it plays a couple of small built in ones, and fails unless
+	- notes with sample numbers past 31, as corrupt mods can have, play the same as notes with no sample number
+	- seeking to a time after jumping to an order the song never reaches plays the same as seeking a new player
+
+ Compile the reference and the build to check from the same source, e.g.
+ gcc verify.c -o verify_ref -std=c99 -O2 -DMOD_PLAYER_NO_SIMD -lm
+ gcc verify.c -o verify_avx2 -std=c99 -O2 -mavx2 -lm
+
+ Run:
+ verify_ref -w reference.bin [-s seconds] <modfile.mod> [more.mod ...]
+ verify_avx2 -r reference.bin [-t max_difference] [-s seconds] <modfile.mod> [more.mod ...]
+
+ -w writes the renders to a file, and -r compares against one written with the same mods and seconds (default 30).
+ with -t, any render that differs from the reference by more than max_difference 16 bit steps fails, and
+ verify exits with 1. without it the differences from the reference are only reported
+
+ The neon kernels are checked the same way, on an arm machine or under qemu, e.g.
+ aarch64-linux-gnu-gcc verify.c -o verify_neon -std=c99 -O2 -static -lm
+ qemu-aarch64 ./verify_neon -r reference.bin -t 0 <modfile.mod> [more.mod ...]
+ The reference can come from any machine, as long as neither build fuses multiplies and adds into fma
+ instructions, which round differently. arm always has them: gcc only leaves them out with -std=c99 (or
+ another iso mode), and clang uses them even then, so add -ffp-contract=off when in doubt
+
+*/
+
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 199309L // for clock_gettime
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MOD_PLAYER_IMPLEMENTATION
+#include "modplayer.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define NUM_RUNS 3
+#define NAME_LENGTH 64
+
+static double now_seconds(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+// the ways each mod is rendered
+typedef struct render_case
+{
+	const char* name;
+	mp_interpolation interpolation;
+	bool stereo;
+	bool float_output;
+	bool split;		// decode in calls of random sizes, rather than 1024 frames at a time
+} render_case;
+
+static const render_case render_cases[] =
+{
+	{ "stereo f32 nearest", MP_INTERPOLATION_NEAREST, true, true, false },
+	{ "stereo f32 linear", MP_INTERPOLATION_LINEAR, true, true, false },
+	{ "stereo f32 cubic", MP_INTERPOLATION_CUBIC, true, true, false },
+	{ "stereo f32 sinc", MP_INTERPOLATION_SINC, true, true, false },
+	{ "mono f32 linear", MP_INTERPOLATION_LINEAR, false, true, false },
+	{ "stereo s16 linear", MP_INTERPOLATION_LINEAR, true, false, false },
+	{ "split f32 linear", MP_INTERPOLATION_LINEAR, true, true, true },
+	{ "split f32 sinc", MP_INTERPOLATION_SINC, true, true, true },
+};
+
+#define NUM_CASES (int)(sizeof(render_cases) / sizeof(render_cases[0]))
+
+// each render in a reference file is a header followed by num_values floats (16 bit output is stored as floats too)
+typedef struct render_header
+{
+	char name[NAME_LENGTH];
+	unsigned int num_values;
+	double realtime;
+} render_header;
+
+static const char* build_name(void)
+{
+#if defined(MOD_PLAYER_FIXED_POINT)
+	#define VERIFY_INTERPOLATION "integer"
+#else
+	#define VERIFY_INTERPOLATION "float"
+#endif
+#if defined(MOD_PLAYER_FLOAT_SAMPLES)
+	#define VERIFY_SAMPLES " interpolation, float samples"
+#else
+	#define VERIFY_SAMPLES " interpolation, 8 bit samples"
+#endif
+#if defined(MP_SIMD_AVX2)
+	#define VERIFY_KERNELS ", avx2 kernels"
+#elif defined(MP_SIMD_SSE2)
+	#define VERIFY_KERNELS ", sse2 kernels"
+#elif defined(MP_SIMD_NEON)
+	#define VERIFY_KERNELS ", neon kernels"
+#else
+	#define VERIFY_KERNELS ", scalar kernels"
+#endif
+#if defined(__cplusplus)
+	#define VERIFY_LANGUAGE ", c++"
+#else
+	#define VERIFY_LANGUAGE ", c"
+#endif
+	return VERIFY_INTERPOLATION VERIFY_SAMPLES VERIFY_KERNELS VERIFY_LANGUAGE;
+}
+
+// 64 bit FNV-1a of the output
+static unsigned long long hash_output(const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned long long hash = 14695981039346656037ull;
+	for(size_t i=0; i<size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// decode from the start of the song in 1024 frame calls, or with split in calls of 1 to 4096 frames, the same
+// way every run and every build. returns the realtime factor
+static double render(mp_mod_player* modplayer, const render_case* rc, bool split, unsigned int total_frames, void* buffer)
+{
+	unsigned int out_channels = rc->stereo ? 2 : 1;
+	unsigned int random = 12345;
+
+	modplayer_reset_song_to_beginning(modplayer);
+	double start = now_seconds();
+	unsigned int num_frames = 0;
+	for(unsigned int frame=0; frame<total_frames; frame += num_frames)
+	{
+		num_frames = 1024;
+		if(split)
+		{
+			// not rand(), which isn't the same everywhere
+			random = random * 1664525u + 1013904223u;
+			num_frames = 1 + (random >> 16) % 4096;
+		}
+		num_frames = total_frames - frame < num_frames ? total_frames - frame : num_frames;
+		if(rc->float_output)
+			modplayer_decode_frames_f(modplayer, num_frames, (float*)buffer + frame * out_channels);
+		else
+			modplayer_decode_frames(modplayer, num_frames, (short*)buffer + frame * out_channels);
+	}
+	double elapsed = now_seconds() - start;
+
+	return (double)total_frames / modplayer->output_sample_rate / elapsed;
+}
+
+// fill in a cell of a 4 channel pattern. sample can be anything up to 255, as a corrupt mod's can
+static void set_cell(unsigned char* pattern, int line, int channel, int sample, int period, int effect, int param)
+{
+	unsigned char* cell = &pattern[(line * 4 + channel) * 4];
+	cell[0] = (unsigned char)((sample & 0xf0) | ((period >> 8) & 0x0f));
+	cell[1] = (unsigned char)(period & 0xff);
+	cell[2] = (unsigned char)(((sample & 0x0f) << 4) | (effect & 0x0f));
+	cell[3] = (unsigned char)param;
+}
+
+// a one pattern, 4 channel mod with a looped 128 byte sample 1. the notes on line 8 use sample number
+// bad_sample, which with anything past 31 should play as if it were 0
+static unsigned char* build_test_mod(int bad_sample, unsigned int* size)
+{
+	*size = 1084 + 1024 + 128;
+	unsigned char* buf = (unsigned char*)calloc(*size, 1);
+	memcpy(buf, "bad sample numbers", 18);
+	unsigned char* sample = &buf[20];
+	memcpy(sample, "saw", 3);
+	sample[22] = 0; sample[23] = 64;	// length in words
+	sample[25] = 64;					// volume
+	sample[28] = 0; sample[29] = 64;	// loop length in words
+	buf[950] = 1;						// song length
+	memcpy(&buf[1080], "M.K.", 4);
+
+	unsigned char* pattern = &buf[1084];
+	set_cell(pattern, 0, 0, 1, 428, 0, 0);
+	set_cell(pattern, 0, 1, 1, 320, 0, 0);
+	set_cell(pattern, 8, 0, bad_sample, 0, 0, 0);
+	set_cell(pattern, 8, 1, bad_sample, 214, 0, 0);
+	set_cell(pattern, 8, 2, bad_sample, 254, 0, 0);
+	set_cell(pattern, 8, 3, bad_sample, 0, 0xc, 32);
+
+	signed char* data = (signed char*)&pattern[1024];
+	for(int i=0; i<128; ++i)
+		data[i] = (signed char)(i * 2 - 128);
+	return buf;
+}
+
+// notes with sample numbers past the mod's samples have to play the same as ones with no sample. returns
+// 1 if they don't
+static int verify_bad_samples(void)
+{
+	unsigned int total_frames = 48000 * 2;
+	float* outputs[2];
+	for(int i=0; i<2; ++i)
+	{
+		unsigned int size;
+		unsigned char* buf = build_test_mod(i == 0 ? 0 : 255, &size);
+		mp_mod_player* modplayer = modplayer_create_from_buffer(buf, size);
+		free(buf);
+		outputs[i] = (float*)calloc(total_frames * 2, sizeof(float));
+		if(modplayer == NULL)
+			continue;
+		render(modplayer, &render_cases[1], false, total_frames, outputs[i]);
+		modplayer_free(modplayer);
+	}
+
+	bool failed = memcmp(outputs[0], outputs[1], total_frames * 2 * sizeof(float)) != 0;
+	printf("sample numbers past 31 play as no sample%s\n", failed ? "  FAIL" : "");
+	free(outputs[0]);
+	free(outputs[1]);
+	return failed;
+}
+
+// a 3 order mod whose first order jumps (B02 on its last line) straight to the last, so order 1 is never
+// played from the start
+static unsigned char* build_jump_mod(unsigned int* size)
+{
+	*size = 1084 + 3 * 1024 + 128;
+	unsigned char* buf = (unsigned char*)calloc(*size, 1);
+	memcpy(buf, "jump to order 2", 15);
+	unsigned char* sample = &buf[20];
+	memcpy(sample, "saw", 3);
+	sample[22] = 0; sample[23] = 64;
+	sample[25] = 64;
+	sample[28] = 0; sample[29] = 64;
+	buf[950] = 3;
+	buf[952] = 0; buf[953] = 1; buf[954] = 2;
+	memcpy(&buf[1080], "M.K.", 4);
+
+	unsigned char* patterns = &buf[1084];
+	set_cell(&patterns[0], 0, 0, 1, 428, 0, 0);
+	set_cell(&patterns[0], 63, 0, 0, 0, 0xb, 2);
+	set_cell(&patterns[1024], 0, 0, 1, 320, 0, 0);
+	set_cell(&patterns[1024], 8, 1, 1, 214, 0, 0);
+	set_cell(&patterns[2048], 0, 0, 1, 254, 0, 0);
+	set_cell(&patterns[2048], 16, 1, 1, 170, 0, 0);
+
+	signed char* data = (signed char*)&patterns[3 * 1024];
+	for(int i=0; i<128; ++i)
+		data[i] = (signed char)(i * 2 - 128);
+	return buf;
+}
+
+// a straight jump to an order leaves the player off the song's timeline, so seeking to a time afterwards
+// has to start again rather than carry on from the jump. returns 1 if the two players don't play the same
+static int verify_seek_after_jump(void)
+{
+	unsigned int size;
+	unsigned char* buf = build_jump_mod(&size);
+	mp_mod_player* jumped = modplayer_create_from_buffer(buf, size);
+	mp_mod_player* fresh = modplayer_create_from_buffer(buf, size);
+	free(buf);
+
+	bool failed = true;
+	if(jumped != NULL && fresh != NULL)
+	{
+		unsigned int total_frames = 48000;
+		float* outputs[2];
+		outputs[0] = (float*)malloc(total_frames * 2 * sizeof(float));
+		outputs[1] = (float*)malloc(total_frames * 2 * sizeof(float));
+
+		modplayer_seek_order(jumped, 1);
+		modplayer_seek_seconds(jumped, 1.0f);
+		modplayer_seek_seconds(fresh, 1.0f);
+		failed = jumped->pattern_idx != fresh->pattern_idx || jumped->line_idx != fresh->line_idx ||
+			jumped->position_frames != fresh->position_frames;
+		modplayer_decode_frames_f(jumped, total_frames, outputs[0]);
+		modplayer_decode_frames_f(fresh, total_frames, outputs[1]);
+		failed = failed || memcmp(outputs[0], outputs[1], total_frames * 2 * sizeof(float)) != 0;
+
+		free(outputs[0]);
+		free(outputs[1]);
+	}
+	printf("seeking after a jump to an unplayed order%s\n\n", failed ? "  FAIL" : "");
+	modplayer_free(jumped);
+	modplayer_free(fresh);
+	return failed;
+}
+
+// render a mod every way, writing the renders to ref_out or comparing them with the ones in ref_in.
+// returns the number of renders that differ from the reference by more than tolerance (if it's >= 0), or that
+// change when the decoding is split up
+static int verify_mod(const char* filename, unsigned int total_frames, FILE* ref_out, FILE* ref_in, double tolerance)
+{
+	mp_mod_player* modplayer = modplayer_create_from_file((char*)filename);
+	if(modplayer == NULL)
+	{
+		fprintf(stderr, "Error loading %s, skipping it\n", filename);
+		return 0;
+	}
+	printf("%s (%s)\n", filename, modplayer->mod->name);
+
+	unsigned int max_values = total_frames * 2;
+	void* buffer = malloc(max_values * sizeof(float));
+	float* values = (float*)malloc(max_values * sizeof(float));
+	float* reference = (float*)malloc(max_values * sizeof(float));
+	float* unsplit = (float*)malloc(max_values * sizeof(float));
+
+	int failures = 0;
+	for(int c=0; c<NUM_CASES; ++c)
+	{
+		const render_case* rc = &render_cases[c];
+		modplayer_set_stereo(modplayer, rc->stereo);
+		modplayer_set_interpolation(modplayer, rc->interpolation);
+
+		double realtime = 0.0;
+		for(int run=0; run<NUM_RUNS; ++run)
+		{
+			double factor = render(modplayer, rc, rc->split, total_frames, buffer);
+			realtime = factor > realtime ? factor : realtime;
+		}
+
+		unsigned int num_values = total_frames * (rc->stereo ? 2 : 1);
+		size_t output_size = num_values * (rc->float_output ? sizeof(float) : sizeof(short));
+		unsigned long long hash = hash_output(buffer, output_size);
+		for(unsigned int i=0; i<num_values; ++i)
+			values[i] = rc->float_output ? ((float*)buffer)[i] : ((short*)buffer)[i] * (1.0f / 32767.0f);
+
+		printf("  %-20s %8.0fx  %016llx", rc->name, realtime, hash);
+
+		bool failed = false;
+		render_header header;
+		memset(&header, 0x00, sizeof(header));
+		snprintf(header.name, NAME_LENGTH, "%s %s", modplayer->mod->name, rc->name);
+		if(ref_out != NULL)
+		{
+			header.num_values = num_values;
+			header.realtime = realtime;
+			fwrite(&header, sizeof(header), 1, ref_out);
+			fwrite(values, sizeof(float), num_values, ref_out);
+		}
+
+		render_header ref_header;
+		if(ref_in != NULL)
+		{
+			if(fread(&ref_header, sizeof(ref_header), 1, ref_in) != 1 || strncmp(ref_header.name, header.name, NAME_LENGTH) != 0 ||
+				ref_header.num_values != num_values || fread(reference, sizeof(float), num_values, ref_in) != num_values)
+			{
+				printf("\nThe reference file doesn't match these mods and settings\n");
+				exit(1);
+			}
+
+			// in 16 bit steps, so the differences are on the same scale for every output format
+			double max_diff = 0.0;
+			double sum_squares = 0.0;
+			for(unsigned int i=0; i<num_values; ++i)
+			{
+				double diff = fabs((double)values[i] - (double)reference[i]) * 32767.0;
+				max_diff = diff > max_diff ? diff : max_diff;
+				sum_squares += diff * diff;
+			}
+			double rms_diff = sqrt(sum_squares / num_values);
+
+			bool differs = tolerance >= 0.0 && max_diff > tolerance;
+			failed = failed || differs;
+			printf("  %5.2fx ref  max diff %9.4f  rms %9.4f%s", realtime / ref_header.realtime, max_diff, rms_diff, differs ? "  FAIL" : "");
+		}
+
+		if(rc->split)
+		{
+			render(modplayer, rc, false, total_frames, unsplit);
+			double split_diff = 0.0;
+			for(unsigned int i=0; i<num_values; ++i)
+			{
+				double diff = fabs((double)values[i] - (double)unsplit[i]) * 32767.0;
+				split_diff = diff > split_diff ? diff : split_diff;
+			}
+			failed = failed || split_diff > 0.0;
+			printf("  split diff %9.4f%s", split_diff, split_diff > 0.0 ? "  FAIL" : "");
+		}
+		failures += failed;
+		printf("\n");
+	}
+	printf("\n");
+
+	free(unsplit);
+	free(reference);
+	free(values);
+	free(buffer);
+	modplayer_free(modplayer);
+	return failures;
+}
+
+int main(int argc, char* argv[])
+{
+	float seconds = 30.0f;
+	double tolerance = -1.0;
+	const char* write_filename = NULL;
+	const char* read_filename = NULL;
+	int first_mod = 1;
+	while(first_mod + 1 < argc && argv[first_mod][0] == '-')
+	{
+		const char* option = argv[first_mod];
+		const char* value = argv[first_mod + 1];
+		if(strcmp(option, "-s") == 0)
+			seconds = (float)atof(value);
+		else if(strcmp(option, "-t") == 0)
+			tolerance = atof(value);
+		else if(strcmp(option, "-w") == 0)
+			write_filename = value;
+		else if(strcmp(option, "-r") == 0)
+			read_filename = value;
+		else
+			break;
+		first_mod += 2;
+	}
+
+	if(first_mod >= argc || seconds <= 0.0f || (write_filename == NULL) == (read_filename == NULL))
+	{
+		printf("Usage: verify -w reference.bin [-s seconds] <modfile.mod> [more.mod ...]\n");
+		printf("       verify -r reference.bin [-t max_difference] [-s seconds] <modfile.mod> [more.mod ...]\n");
+		exit(0);
+	}
+
+	FILE* ref_out = NULL;
+	FILE* ref_in = NULL;
+	if(write_filename != NULL)
+		ref_out = fopen(write_filename, "wb");
+	else
+		ref_in = fopen(read_filename, "rb");
+	if(ref_out == NULL && ref_in == NULL)
+	{
+		fprintf(stderr, "Error opening %s\n", write_filename != NULL ? write_filename : read_filename);
+		exit(1);
+	}
+
+	printf("%s\n\n", build_name());
+
+	unsigned int total_frames = (unsigned int)(seconds * 48000);
+	int failures = verify_bad_samples() + verify_seek_after_jump();
+	for(int i=first_mod; i<argc; ++i)
+		failures += verify_mod(argv[i], total_frames, ref_out, ref_in, tolerance);
+
+	if(ref_out != NULL)
+		fclose(ref_out);
+	if(ref_in != NULL)
+		fclose(ref_in);
+
+	if(failures > 0)
+	{
+		printf("%d renders failed\n", failures);
+		return 1;
+	}
+	return 0;
+}